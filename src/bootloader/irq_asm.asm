@@ -3,8 +3,10 @@ BITS 64
 SECTION .text
 
 GLOBAL pic_init
+GLOBAL irq0_handler
 GLOBAL irq1_handler
 
+EXTERN timer_handler
 EXTERN keyboard_handler
 
 %macro PUSH_REGS 0
@@ -66,6 +68,19 @@ pic_init:
     out 0xA1, al
     ret
 
+; IRQ0 = PIT timer (interrupt vector 32 after remap)
+irq0_handler:
+    PUSH_REGS
+
+    call timer_handler
+
+    ; Send EOI to master PIC
+    mov al, 0x20
+    out 0x20, al
+
+    POP_REGS
+    iretq
+
 ; IRQ1 = keyboard (interrupt vector 33 after remap)
 irq1_handler:
     PUSH_REGS
@@ -2,6 +2,7 @@
 ; Stage1.5: loads stage2 (kernel.bin) from disk using INT 13h Extensions,
 ;           bounce-buffering below 1MiB, then copies to 1MiB in protected mode,
 ;           then enters long mode and jumps to 0x00100000 with EAX=mem_MB.
+;           The full E820 map is left at BOOTINFO_ADDR for the kernel.
 
 BITS 16
 ORG 0x7E00
@@ -25,8 +26,14 @@ STAGE2_LBA       equ (1 + STAGE15_SECTORS)
 ; We cannot reliably DMA to 0x00100000 in real mode via DAP seg:off.
 KERNEL_LOAD_PM   equ 0x00100000        ; final location expected by your linker
 KERNEL_BOUNCE_RM equ 0x00010000        ; bounce buffer in low memory (<1MiB)
-BOOTINFO_ADDR    equ 0x00009000
-BOOTINFO_MEM_MB  equ BOOTINFO_ADDR
+; Boot info block (see memory.h). Kept clear of stage1.5 and its page
+; tables, which start at 0x7E00.
+BOOTINFO_ADDR       equ 0x00001000
+BOOTINFO_MEM_MB     equ BOOTINFO_ADDR + 0
+BOOTINFO_E820_COUNT equ BOOTINFO_ADDR + 4
+BOOTINFO_E820_TABLE equ BOOTINFO_ADDR + 8
+E820_ENTRY_SIZE     equ 24
+E820_MAX_ENTRIES    equ 128
 
 ; Conservative BIOS read chunk.
 MAX_SECTORS_PER_READ equ 0x007F        ; 127
@@ -63,44 +70,60 @@ enable_a20:
     out 0x92, al
     ret
 
-; Store detected memory in MB at BOOTINFO_MEM_MB (E820 max-addr based)
+; Copy the E820 map to BOOTINFO_E820_TABLE and store the highest usable
+; address in MB at BOOTINFO_MEM_MB
 detect_memory_e820:
     pushad
     xor ebx, ebx
     mov dword [BOOTINFO_MEM_MB], 16
+    mov dword [BOOTINFO_E820_COUNT], 0
+    mov dword [e820_max_lo], 0
+    mov dword [e820_max_hi], 0
 
-    xor edi, edi          ; max_end_lo
-    xor esi, esi          ; max_end_hi
+    mov di, BOOTINFO_E820_TABLE
 
 .e820_next:
+    mov dword [di + 20], 1     ; ACPI attrs, for BIOSes returning 20 bytes
     mov eax, 0xE820
     mov edx, 0x534D4150
-    mov ecx, 24
-    mov di, e820_buf
+    mov ecx, E820_ENTRY_SIZE
     int 0x15
     jc .done
     cmp eax, 0x534D4150
     jne .done
 
-    mov eax, [e820_buf + 16]   ; type
+    ; Drop empty entries and ones flagged "ignore" (ACPI 3.0 bit 0 clear)
+    mov eax, [di + 8]
+    or eax, [di + 12]
+    jz .cont
+    test byte [di + 20], 1
+    jz .cont
+
+    mov eax, [di + 16]         ; type
     cmp eax, 1                 ; usable
-    jne .cont
+    jne .keep
 
     ; end = base + length (64-bit)
-    mov eax, [e820_buf + 0]
-    mov edx, [e820_buf + 4]
-    add eax, [e820_buf + 8]
-    adc edx, [e820_buf + 12]
+    mov eax, [di + 0]
+    mov edx, [di + 4]
+    add eax, [di + 8]
+    adc edx, [di + 12]
 
     ; track max end address
-    cmp edx, esi
-    jb .cont
+    cmp edx, [e820_max_hi]
+    jb .keep
     ja .setmax
-    cmp eax, edi
-    jbe .cont
+    cmp eax, [e820_max_lo]
+    jbe .keep
 .setmax:
-    mov edi, eax
-    mov esi, edx
+    mov [e820_max_lo], eax
+    mov [e820_max_hi], edx
+
+.keep:
+    add di, E820_ENTRY_SIZE
+    inc dword [BOOTINFO_E820_COUNT]
+    cmp dword [BOOTINFO_E820_COUNT], E820_MAX_ENTRIES
+    jae .done
 
 .cont:
     test ebx, ebx
@@ -108,13 +131,9 @@ detect_memory_e820:
 
 .done:
     ; Convert max bytes -> MB (shift right 20)
-    mov eax, edi
-    mov edx, esi
-    mov ecx, 20
-.shift:
-    shrd eax, edx, 1
-    shr  edx, 1
-    loop .shift
+    mov eax, [e820_max_lo]
+    mov edx, [e820_max_hi]
+    shrd eax, edx, 20
 
     cmp eax, 16
     jae .store
@@ -124,7 +143,8 @@ detect_memory_e820:
     popad
     ret
 
-e820_buf: times 24 db 0
+e820_max_lo dd 0
+e820_max_hi dd 0
 
 ; -------------------------
 ; Kernel load (bounce buffer) in RM, chunked reads
@@ -0,0 +1,67 @@
+; src/bootloader/switch_asm.asm
+BITS 64
+SECTION .text
+
+GLOBAL context_switch
+GLOBAL process_trampoline
+
+EXTERN process_exit
+
+; cpu_context_t field offsets (see process.h)
+%define CTX_RBX     8
+%define CTX_RSP     48
+%define CTX_RBP     56
+%define CTX_R12     96
+%define CTX_R13     104
+%define CTX_R14     112
+%define CTX_R15     120
+%define CTX_RIP     128
+%define CTX_RFLAGS  136
+
+; void context_switch(cpu_context_t* old_context, cpu_context_t* new_context)
+; Save the callee-saved registers, stack pointer and flags into *old and
+; resume *new. The caller-saved registers are dead across the call, so
+; they are neither saved nor restored. *old resumes by returning from
+; this call.
+context_switch:
+    pushfq
+    pop qword [rdi + CTX_RFLAGS]
+    cli
+
+    mov [rdi + CTX_RBX], rbx
+    mov [rdi + CTX_RBP], rbp
+    mov [rdi + CTX_R12], r12
+    mov [rdi + CTX_R13], r13
+    mov [rdi + CTX_R14], r14
+    mov [rdi + CTX_R15], r15
+
+    ; Resume at our return address with the return already popped
+    mov rax, [rsp]
+    mov [rdi + CTX_RIP], rax
+    lea rax, [rsp + 8]
+    mov [rdi + CTX_RSP], rax
+
+    mov rbx, [rsi + CTX_RBX]
+    mov rbp, [rsi + CTX_RBP]
+    mov r12, [rsi + CTX_R12]
+    mov r13, [rsi + CTX_R13]
+    mov r14, [rsi + CTX_R14]
+    mov r15, [rsi + CTX_R15]
+    mov rsp, [rsi + CTX_RSP]
+
+    ; Flags last: interrupts stay off until the new stack is live
+    push qword [rsi + CTX_RFLAGS]
+    popfq
+    jmp [rsi + CTX_RIP]
+
+; First code run on a new thread's kernel stack. process_create leaves
+; the entry point in r12 and a 16-byte aligned stack; returning from the
+; entry point ends the thread.
+process_trampoline:
+    xor rbp, rbp
+    call r12
+    call process_exit
+.hang:
+    cli
+    hlt
+    jmp .hang
@@ -0,0 +1,36 @@
+// src/include/core/fpu.h - Lazy FPU/SSE state switching
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+
+struct process;
+
+#define FPU_STATE_SIZE  512     // FXSAVE area
+#define FPU_STATE_ALIGN 16
+
+typedef struct {
+    uint64_t traps;             // #NM faults taken
+    uint64_t saves;             // Register sets written back to their owner
+    uint64_t restores;          // ... loaded from a thread's saved state
+    uint64_t inits;             // First use by a thread: clean state
+} fpu_stats_t;
+
+// Enable SSE and arm the first #NM. The registers belong to no thread
+// until one of them touches them.
+void fpu_init(void);
+
+// Called on every switch to `next`: vector registers stay loaded and
+// CR0.TS is set unless `next` already owns them, so a thread pays for a
+// save/restore only when it actually uses FPU/SSE after another one did.
+void fpu_switch(struct process* next);
+
+// #NM (device not available) handler, vector 7
+void fpu_handle_nm(void);
+
+// Forget a thread's state before its PCB is freed
+void fpu_release(struct process* proc);
+
+void fpu_get_stats(fpu_stats_t* stats);
+
+#endif // FPU_H
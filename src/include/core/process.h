@@ -7,6 +7,11 @@
 
 #define MAX_PROCESSES 256
 
+// Stacks: kernel stacks live in kernel virtual memory, user stacks are
+// mapped privately at the top of each process's lower half
+#define PROCESS_STACK_SIZE  8192
+#define USER_STACK_TOP      0x00007FFFFFFFF000ULL
+
 // Process states
 typedef enum {
     PROCESS_READY,
@@ -15,7 +20,9 @@ typedef enum {
     PROCESS_TERMINATED
 } process_state_t;
 
-// CPU context saved during context switch (64-bit)
+// CPU context saved during context switch (64-bit). context_switch() in
+// switch_asm.asm saves rbx, rbp, r12-r15, rsp, rip and rflags by offset,
+// so keep the layout in sync with it.
 typedef struct {
     // General purpose registers (64-bit)
     uint64_t rax, rbx, rcx, rdx;
@@ -41,11 +48,15 @@ typedef struct process {
     process_state_t state;           // Current state
 
     cpu_context_t context;           // Saved CPU context
+    void (*entry_point)(void);       // Where the thread starts
     page_directory_t* page_dir;      // Process page directory (PML4)
+    uint16_t pcid;                   // TLB tag for page_dir (0 = kernel/none)
 
     uint64_t kernel_stack;           // Kernel stack pointer (64-bit)
     uint64_t user_stack;             // User stack pointer (64-bit)
 
+    void* fpu_state;                 // FXSAVE area, NULL until FPU/SSE is first used
+
     uint32_t priority;               // Scheduling priority
     uint32_t time_slice;             // Remaining time slice
 
@@ -56,12 +67,35 @@ typedef struct process {
 void process_init(void);
 process_t* process_create(const char* name, void (*entry_point)(void), uint32_t is_kernel);
 void process_destroy(process_t* proc);
+
+// Duplicate a user process. The address space is shared copy-on-write, so
+// the cost is the parent's page-table pages, not its resident memory.
+// The child starts over at the parent's entry point.
+process_t* process_clone(process_t* parent);
+
+// Save the running thread's registers and resume `next`. With no process
+// running, the caller's context is kept as the boot context, which is
+// resumed once nothing is ready.
 void process_switch(process_t* next);
+
+// End the running thread; called when its entry point returns
+void process_exit(void);
+
 process_t* process_get_current(void);
 void scheduler_init(void);
 void schedule(void);
 void yield(void);
 
+typedef struct {
+    uint32_t switches;          // Context switches timed
+    uint64_t cycles;            // Average cycles per switch
+    uint64_t fpu_traps;         // #NM faults taken during the run
+} process_switch_bench_t;
+
+// Ping-pong two kernel threads through yield() for `rounds` rounds each;
+// with `use_fpu` both touch an SSE register every round
+int process_switch_benchmark(uint32_t rounds, int use_fpu, process_switch_bench_t* out);
+
 // Test functions
 void test_process_1(void);
 void test_process_2(void);
@@ -27,4 +27,8 @@ void serial_put_hex(uint32_t val);
 // Write decimal value
 void serial_put_dec(uint32_t val);
 
+// 64-bit variants (used by %llx / %llu)
+void serial_put_hex64(uint64_t val);
+void serial_put_dec64(uint64_t val);
+
 #endif
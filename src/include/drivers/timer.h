@@ -0,0 +1,56 @@
+// src/include/drivers/timer.h - PIT system tick with tickless idle
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "../core/types.h"
+
+// Tick rate; override at build time with -DTIMER_HZ=<hz> (19 .. 1193181)
+#ifndef TIMER_HZ
+#define TIMER_HZ 100
+#endif
+
+#define PIT_FREQUENCY       1193182     // PIT input clock (Hz)
+#define TIMER_ONESHOT_MAX   0xF000      // Longest idle sleep in PIT cycles (~51 ms)
+
+// Ticks since timer_init(); advanced by IRQ0 and by idle sleeps
+extern volatile uint64_t jiffies;
+
+// One-shot callback, run from the timer interrupt once `expires` is reached
+typedef struct timer_event {
+    uint64_t expires;           // jiffies
+    void (*callback)(void* arg);
+    void* arg;
+    struct timer_event* next;
+    int pending;
+} timer_event_t;
+
+typedef struct {
+    uint32_t hz;
+    uint64_t interrupts;        // IRQ0s taken
+    uint64_t idle_sleeps;       // Idle periods run on a one-shot instead of ticks
+    uint64_t early_wakeups;     // ... cut short by another interrupt
+    uint64_t idle_ticks;        // Ticks that passed during those sleeps
+} timer_stats_t;
+
+// Program PIT channel 0 for `hz` periodic interrupts and unmask IRQ0
+void timer_init(uint32_t hz);
+
+uint32_t timer_get_hz(void);
+uint64_t timer_uptime_ms(void);
+
+// Arm an event `delay` ticks from now (re-arming moves it); callbacks run
+// with interrupts disabled and must not block
+void timer_add(timer_event_t* event, uint64_t delay, void (*callback)(void* arg), void* arg);
+void timer_cancel(timer_event_t* event);
+
+// Sleep until the next interrupt. With nothing due for more than a tick
+// the PIT is switched to a one-shot for the next deadline, so an idle
+// machine takes no periodic interrupts. Returns with interrupts enabled.
+void timer_idle(void);
+
+// IRQ0 handler (called from irq_asm.asm)
+void timer_handler(void);
+
+void timer_get_stats(timer_stats_t* stats);
+
+#endif // TIMER_H
@@ -118,6 +118,25 @@ typedef struct __attribute__((packed)) {
     uint64_t data_length;            // Table size in bytes
 } exfat_upcase_entry_t;
 
+// Per-volume I/O buffer pool: cluster- and sector-sized buffers are
+// preallocated at mount and handed out by reference count.
+#define EXFAT_POOL_CLUSTERS 4
+#define EXFAT_POOL_SECTORS  4
+
+typedef struct {
+    uint8_t* data;
+    uint32_t refcount;
+} exfat_buffer_t;
+
+typedef struct {
+    exfat_buffer_t clusters[EXFAT_POOL_CLUSTERS];
+    exfat_buffer_t sectors[EXFAT_POOL_SECTORS];
+    uint8_t* cluster_memory;         // Backing store for cluster buffers
+    uint8_t* sector_memory;          // Backing store for sector buffers
+    uint32_t hits;                   // Requests served from the pool
+    uint32_t misses;                 // Requests that fell back to kmalloc
+} exfat_buffer_pool_t;
+
 // Mounted exFAT Volume Structure
 typedef struct {
     exfat_boot_sector_t boot_sector;
@@ -131,6 +150,7 @@ typedef struct {
     uint8_t* bitmap_cache;           // Cached allocation bitmap
     uint32_t bitmap_cluster;
     uint64_t bitmap_length;
+    exfat_buffer_pool_t pool;
 } exfat_volume_t;
 
 // File Handle Structure
@@ -180,6 +200,12 @@ uint32_t exfat_get_next_cluster(exfat_volume_t* volume, uint32_t cluster);
 int exfat_read_cluster(exfat_volume_t* volume, uint32_t cluster, void* buffer);
 int exfat_write_cluster(exfat_volume_t* volume, uint32_t cluster, const void* buffer);
 
+// Buffer pool: get returns a buffer holding one reference; put drops it
+// and recycles the buffer when the count reaches zero.
+uint8_t* exfat_get_cluster_buffer(exfat_volume_t* volume);
+uint8_t* exfat_get_sector_buffer(exfat_volume_t* volume);
+void exfat_put_buffer(exfat_volume_t* volume, uint8_t* buffer);
+
 // Disk I/O (exported for file operations)
 int disk_read_sector(uint32_t sector, void* buffer);
 int disk_write_sector(uint32_t sector, const void* buffer);
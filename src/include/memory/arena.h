@@ -0,0 +1,45 @@
+// src/include/memory/arena.h - Scoped bump allocator for short-lived scratch memory
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "../core/types.h"
+
+#define ARENA_CHUNK_SIZE  (16 * 1024)   // Standard chunk, recycled between arenas
+#define ARENA_ALIGN       16
+
+// Chunks are page blocks chained per arena; data follows the header
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    uint64_t size;              // Chunk size in bytes, header included
+    uint64_t used;              // Offset of the next free byte
+} arena_chunk_t;
+
+// The arena itself lives at the front of its first chunk
+typedef struct arena {
+    arena_chunk_t* chunks;      // Current chunk first
+    uint64_t allocated;         // Bytes handed out since create/reset
+} arena_t;
+
+typedef struct {
+    uint32_t arenas_created;
+    uint32_t chunks_pooled;     // Chunks waiting for reuse
+    uint32_t chunk_reuses;      // Chunk requests served from the pool
+    uint32_t chunk_allocs;      // Chunk requests that went to the PMM
+} arena_stats_t;
+
+// Create an arena; returns NULL when out of memory
+arena_t* arena_create(void);
+
+// Bump-allocate `size` bytes aligned to ARENA_ALIGN. Memory is only
+// released by arena_reset() or arena_destroy().
+void* arena_alloc(arena_t* arena, size_t size);
+
+// Release everything allocated from the arena but keep the arena
+void arena_reset(arena_t* arena);
+
+// Release the arena and all of its memory
+void arena_destroy(arena_t* arena);
+
+void arena_get_stats(arena_stats_t* stats);
+
+#endif // ARENA_H
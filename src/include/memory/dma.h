@@ -3,6 +3,22 @@
 
 #include "../core/types.h"
 
+// Low-memory DMA pool: 0x10000 - 0x9FFFF, handed out in 4KB pages
+#define DMA_PAGE_SIZE   4096
+#define DMA_SG_MAX      16      // Segments in one scatter-gather list
+
+// One physically contiguous piece of a scatter-gather buffer
+typedef struct {
+    uint64_t phys;              // Physical (and identity-mapped) address
+    uint32_t length;            // Bytes, a multiple of DMA_PAGE_SIZE
+} dma_segment_t;
+
+typedef struct {
+    uint32_t count;             // Segments in use
+    uint32_t total;             // Sum of segment lengths
+    dma_segment_t segments[DMA_SG_MAX];
+} dma_sg_list_t;
+
 // Initialize DMA buffer pool (call after physical_mm_init)
 void dma_init(void);
 
@@ -13,7 +29,19 @@ void* dma_alloc(uint32_t size);
 // Free DMA buffer
 void dma_free(void* ptr);
 
+// Allocate `size` bytes as up to DMA_SG_MAX contiguous segments, each at
+// most max_segment bytes (0 = no limit). Fewest segments first: free runs
+// are taken whole. Returns -1 (nothing allocated) if the pool cannot
+// cover the request.
+int dma_sg_alloc(dma_sg_list_t* sg, uint32_t size, uint32_t max_segment);
+
+// Free every segment of a list allocated by dma_sg_alloc()
+void dma_sg_free(dma_sg_list_t* sg);
+
 // Get DMA statistics
 void dma_get_stats(uint32_t* total, uint32_t* used, uint32_t* free);
 
-#endif
\ No newline at end of file
+// Largest contiguous free run, in bytes
+uint32_t dma_get_largest_free(void);
+
+#endif
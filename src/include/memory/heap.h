@@ -4,23 +4,65 @@
 
 #include "../core/types.h"
 
-// Heap block header structure
+// TLSF geometry: 32 second-level lists per power of two, 8-byte granularity
+#define HEAP_SL_INDEX_COUNT_LOG2 5
+#define HEAP_SL_INDEX_COUNT      (1 << HEAP_SL_INDEX_COUNT_LOG2)
+#define HEAP_ALIGN_SIZE_LOG2     3
+#define HEAP_ALIGN_SIZE          (1 << HEAP_ALIGN_SIZE_LOG2)
+#define HEAP_FL_INDEX_MAX        40      // Largest block just under 1TB
+#define HEAP_FL_INDEX_SHIFT      (HEAP_SL_INDEX_COUNT_LOG2 + HEAP_ALIGN_SIZE_LOG2)
+#define HEAP_FL_INDEX_COUNT      (HEAP_FL_INDEX_MAX - HEAP_FL_INDEX_SHIFT + 1)
+#define HEAP_SMALL_BLOCK_SIZE    (1 << HEAP_FL_INDEX_SHIFT)
+
+// Requests at or above this size are page-granular and bypass the heap
+#define HEAP_LARGE_THRESHOLD     (64 * 1024)
+
+// Heap block header. prev_phys is the boundary tag of the previous block,
+// valid only while that block is free. The free-list links overlay the
+// first bytes of the payload and are only meaningful while free.
 typedef struct heap_block {
-    uint32_t size;              // Size of block (excluding header)
-    uint32_t is_free;           // 1 if free, 0 if allocated
-    struct heap_block* next;    // Next block in list
-    struct heap_block* prev;    // Previous block in list
+    struct heap_block* prev_phys;   // Previous physical block (if free)
+    uint64_t size;                  // Payload size; low bits hold flags
+    uint32_t site;                  // Profiling site that owns the block
+    uint32_t requested;             // Bytes the caller asked for
+    struct heap_block* next_free;   // Next block in the segregated list
+    struct heap_block* prev_free;   // Previous block in the segregated list
 } heap_block_t;
 
 // Heap statistics
 typedef struct {
-    uint32_t total_size;
-    uint32_t used_size;
-    uint32_t free_size;
+    uint64_t total_size;
+    uint64_t used_size;
+    uint64_t free_size;
     uint32_t num_blocks;
     uint32_t num_free_blocks;
+    uint64_t large_size;            // Bytes in page-granular large allocations
+    uint32_t num_large;
 } heap_stats_t;
 
+// Allocation profiling: each call site (caller tag, or return address
+// when untagged) gets live counters updated on every alloc and free.
+#define HEAP_MAX_SITES     64
+#define HEAP_HIST_BUCKETS  16       // Power-of-two request sizes, 16B .. >256KB
+
+typedef struct {
+    const char* tag;                // Caller-supplied tag, or NULL
+    uintptr_t caller;               // Return address of untagged callers
+    uint64_t live_bytes;
+    uint32_t live_allocs;
+    uint32_t total_allocs;
+} heap_site_t;
+
+typedef struct {
+    uint64_t used_size;             // Live bytes, heap plus large allocations
+    uint64_t peak_used;             // High-water mark of used_size
+    uint64_t free_size;
+    uint64_t largest_free;          // Largest single free heap block
+    uint32_t frag_permille;         // 1000 * (1 - largest_free / free_size)
+    uint32_t num_sites;
+    uint32_t histogram[HEAP_HIST_BUCKETS];
+} heap_profile_t;
+
 // Initialize kernel heap (call before paging)
 void heap_init(void);
 
@@ -30,7 +72,10 @@ void heap_init_virtual(void);
 // Allocate memory from kernel heap
 void* kmalloc(size_t size);
 
-// Allocate aligned memory
+// Allocate memory charged to a named tag instead of the return address
+void* kmalloc_tagged(size_t size, const char* tag);
+
+// Allocate memory aligned to a power-of-two boundary
 void* kmalloc_aligned(size_t size, size_t alignment);
 
 // Free memory
@@ -39,9 +84,19 @@ void kfree(void* ptr);
 // Reallocate memory
 void* krealloc(void* ptr, size_t new_size);
 
+// Bytes requested for a live allocation (0 for NULL)
+size_t ksize(const void* ptr);
+
 // Get heap statistics
 void heap_get_stats(heap_stats_t* stats);
 
+// Profiling counters; sites are indexed 0 .. HEAP_MAX_SITES-1
+void heap_get_profile(heap_profile_t* profile);
+const heap_site_t* heap_get_site(uint32_t index);
+
+// Print profiling counters to serial as key=value records
+void heap_profile_dump(void);
+
 // Debug: print heap state
 void heap_debug_print(void);
 
@@ -0,0 +1,58 @@
+// src/include/memory/kzone.h - Named allocation zones with quotas and accounting
+#ifndef KZONE_H
+#define KZONE_H
+
+#include "../core/types.h"
+
+#define KZONE_MAX       16
+#define KZONE_NAME_LEN  16
+
+// Global free memory levels for zone reclaim. Callbacks run when free
+// memory drops below the low mark and are not asked again until it has
+// climbed back above the high one.
+#define KZONE_LOW_WATERMARK   (4ULL * 1024 * 1024)
+#define KZONE_HIGH_WATERMARK  (8ULL * 1024 * 1024)
+
+typedef struct kzone kzone_t;
+
+// Give back up to `bytes` of memory; returns the net bytes freed
+typedef uint64_t (*kzone_reclaim_t)(kzone_t* zone, uint64_t bytes);
+
+struct kzone {
+    char name[KZONE_NAME_LEN];
+    uint64_t quota;             // Bytes, 0 = unlimited
+    uint64_t live;              // Bytes currently charged (reserved, not resident:
+                                // a KV_LAZY range counts in full)
+    uint64_t peak;
+    uint32_t allocs;            // Live allocations
+    uint32_t denied;            // Requests refused by the quota
+    kzone_reclaim_t reclaim;
+    uint32_t reclaim_calls;
+    uint64_t reclaimed;         // Bytes the callback reported freed
+};
+
+// Create a zone, or return the existing zone of that name (the quota is
+// then updated). Returns NULL when all KZONE_MAX zones are taken.
+kzone_t* kzone_create(const char* name, uint64_t quota);
+void kzone_set_reclaim(kzone_t* zone, kzone_reclaim_t reclaim);
+
+// kmalloc()/kmalloc_virtual_flags() charged to a zone. Requests that would
+// take the zone past its quota fail. A NULL zone is not accounted. Virtual
+// allocations are charged their full page-rounded size up front, so
+// demand-zero and zram-backed pages count whether resident or not.
+void* kzone_alloc(kzone_t* zone, size_t size);
+void kzone_free(kzone_t* zone, void* ptr);
+void* kzone_alloc_virtual(kzone_t* zone, size_t size, uint32_t flags);
+void kzone_free_virtual(kzone_t* zone, void* ptr, size_t size);
+
+// Ask zone callbacks, largest zone first, for `bytes`; returns bytes freed
+uint64_t kzone_reclaim(uint64_t bytes);
+
+// Run reclaim if free memory has crossed the low watermark. Called on
+// every zone allocation and from the idle loop.
+void kzone_check_watermark(void);
+
+uint32_t kzone_count(void);
+const kzone_t* kzone_get(uint32_t index);
+
+#endif // KZONE_H
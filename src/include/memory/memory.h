@@ -3,6 +3,33 @@
 
 #include "../core/types.h"
 
+// Boot information left in low memory by stage1.5 (see stage15.asm)
+#define BOOTINFO_ADDR       0x1000
+#define BOOTINFO_E820_MAX   128
+
+// E820 region types
+#define E820_TYPE_USABLE    1
+#define E820_TYPE_RESERVED  2
+#define E820_TYPE_ACPI      3
+#define E820_TYPE_NVS       4
+#define E820_TYPE_BAD       5
+
+typedef struct __attribute__((packed)) {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t acpi_attrs;
+} e820_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t mem_mb;                        // Highest usable address in MB
+    uint32_t e820_count;
+    e820_entry_t e820[BOOTINFO_E820_MAX];
+} bootinfo_t;
+
 uint32_t detect_memory(void);
 
+// E820 map handed over by the bootloader; *count is 0 if there is none
+const e820_entry_t* memory_get_e820(uint32_t* count);
+
 #endif
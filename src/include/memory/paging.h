@@ -3,6 +3,7 @@
 #define PAGING_H
 
 #include "../core/types.h"
+#include "vmem.h"
 
 // Page size (same as 32-bit)
 #define PAGE_SIZE 4096
@@ -18,9 +19,19 @@
 // Kernel space (higher half - canonical)
 #define KERNEL_SPACE_START  0xFFFF800000000000ULL
 #define KERNEL_VIRTUAL_BASE 0x0000000000100000ULL  // Currently at 1MB (can move to higher half later)
-#define KERNEL_HEAP_START   0x0000000000400000ULL  // After 4MB kernel
+#define KERNEL_HEAP_START   0x0000000002000000ULL  // Above the 32MB boot identity map
 #define KERNEL_HEAP_END     0x0000000040000000ULL  // 1GB heap
 
+// Direct map of all physical memory, built by paging_init() with 1GB pages
+// (or 2MB where the CPU lacks them). The low 32MB also stay identity-mapped
+// for the kernel image and early boot allocations.
+#define PHYSMAP_BASE        KERNEL_SPACE_START
+#define PHYSMAP_MAX_SIZE    0x0000400000000000ULL  // 64TB (128 PML4 slots)
+#define BOOT_IDENTITY_SIZE  0x0000000002000000ULL  // 32MB
+
+#define PAGE_SIZE_2M        0x200000ULL
+#define PAGE_SIZE_1G        0x40000000ULL
+
 // Page table indices (9 bits each for 512 entries)
 #define PML4_INDEX(addr)  (((addr) >> 39) & 0x1FF)
 #define PDP_INDEX(addr)   (((addr) >> 30) & 0x1FF)
@@ -44,6 +55,27 @@
 #define PAGE_GLOBAL         (1ULL << 8)
 #define PAGE_NX             (1ULL << 63)  // No-execute bit
 
+// paging_init() reprograms PAT entry 1 (PWT alone) from write-through to
+// write-combining when the CPU has a PAT
+#define PAGE_WRITECOMBINE   PAGE_WRITETHROUGH
+
+// Software bits (ignored by the MMU)
+#define PAGE_LAZY           (1ULL << 9)   // Not present: zero-fill on first touch
+#define PAGE_COW            (1ULL << 10)  // Read-only share: copy on first write
+#define PAGE_RECLAIM        (1ULL << 11)  // KV_RECLAIM page: may be compressed to zram
+#define PAGE_ZRAM           (1ULL << 52)  // Not present: frame field is a zram slot
+
+// Control register bits
+#define CR4_PGE             (1ULL << 7)   // Global pages survive CR3 loads
+#define CR4_PCIDE           (1ULL << 17)  // Process-context identifiers
+#define CR3_PCID_MASK       0xFFFULL
+#define CR3_NOFLUSH         (1ULL << 63)  // Keep the PCID's TLB entries
+
+// PCID 0 belongs to the kernel page directory; processes with their own
+// directory get 1..PCID_COUNT-1, or 0 (flushed on every switch) when
+// PCIDs are unsupported or exhausted
+#define PCID_COUNT          4096
+
 // Page table entry (64-bit)
 typedef struct {
     uint64_t present    : 1;   // Present in memory
@@ -80,29 +112,152 @@ typedef struct {
 void paging_init(void);
 void switch_page_directory(page_directory_t* pml4);
 
+// Switch address space, keeping the TLB entries tagged with `pcid` when
+// they are still valid
+void switch_page_directory_pcid(page_directory_t* pml4, uint16_t pcid);
+uint16_t paging_alloc_pcid(void);
+void paging_free_pcid(uint16_t pcid);
+int paging_pcid_enabled(void);
+
 // Map a virtual address to physical address
 void map_page(page_directory_t* pml4, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
 void unmap_page(page_directory_t* pml4, uint64_t virtual_addr);
 
-// Get physical address from virtual
+// Map one 2MB page with a PD-level PAGE_HUGE entry. Both addresses must be
+// 2MB-aligned. Returns -1 if the slot is already in use.
+int map_huge_page(page_directory_t* pml4, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
+uint32_t paging_get_huge_count(void);
+
+// Ranges above this many pages get one full TLB flush instead of invlpg per
+// page (a CR4.PGE toggle when the range holds global kernel entries)
+#define PAGING_FLUSH_THRESHOLD 32
+
+// Map [virtual_addr, +length) onto contiguous physical memory, walking the
+// upper levels once per page table. PAGE_HUGE in flags allows 2MB entries
+// where both addresses are 2MB-aligned. With PAGE_LAZY nothing is mapped:
+// the PTEs are only marked, and the first access faults in a zeroed frame
+// (physical_addr is ignored). Returns -1 on failure.
+int map_range(page_directory_t* pml4, uint64_t virtual_addr, uint64_t physical_addr,
+              uint64_t length, uint64_t flags);
+
+// Unmap a range; with free_frames each frame loses a reference, and those
+// left unreferenced go back to the PMM in runs after the TLB flush
+void unmap_range(page_directory_t* pml4, uint64_t virtual_addr, uint64_t length, int free_frames);
+
+// Release a process page directory's private lower-half page tables
+void paging_free_user_tables(page_directory_t* pml4);
+
+// Unmap everything in a process directory's private lower half; each
+// frame loses a reference
+void paging_unmap_user(page_directory_t* pml4);
+
+// Give dst (a fresh copy of the kernel PML4) the private lower half of src
+// without copying data: page tables are duplicated, writable leaves turn
+// read-only PAGE_COW in both, and frames gain a reference. Cost is one
+// pass over src's page tables. On failure dst is partially built and is
+// released with paging_unmap_user() and paging_free_user_tables().
+int paging_clone_user(page_directory_t* dst, page_directory_t* src);
+
+// Write faults on PAGE_COW pages, and how many of them had to copy
+void paging_get_cow_stats(uint64_t* faults, uint64_t* copies);
+
+uint32_t paging_get_tlb_full_flushes(void);
+
+// Get physical address from virtual (pml4 NULL = kernel page directory)
 uint64_t get_physical_address(page_directory_t* pml4, uint64_t virtual_addr);
 
+// Physmap translation. Before paging_init() switches page tables the
+// offset is zero and physical memory is reached through the identity map.
+extern uint64_t physmap_offset;
+
+static inline void* phys_to_virt(uint64_t physical_addr) {
+    return (void*)(uintptr_t)(physical_addr + physmap_offset);
+}
+
+// Physmap, identity or page-table translation of a kernel pointer
+uint64_t virt_to_phys(const void* virt);
+
 // Kernel page directory
 page_directory_t* get_kernel_page_dir(void);
 
 // Virtual memory allocator
+#define KV_LAZY   0x1   // Reserve address space only; pages are demand-zero
+#define KV_PINNED 0x2   // Frames never move (CR3 targets, kernel stacks)
+#define KV_RECLAIM 0x4  // Cold pages may be compressed to zram under pressure
+
 void* kmalloc_virtual(size_t size);
+void* kmalloc_virtual_flags(size_t size, uint32_t flags);
 void kfree_virtual(void* ptr, size_t size);
 
 // Map physical device memory to virtual space
 void* physical_to_virtual(uint64_t physical_addr, size_t size);
 
-// Page fault handler
+// Page fault handler. Demand-zero, zram and copy-on-write faults are
+// resolved and return; anything else halts.
 void page_fault_handler(uint64_t error_code);
 
+// Demand-zero faults served, and KV_LAZY pages not yet touched
+void paging_get_lazy_stats(uint64_t* faults, uint64_t* pending_pages);
+
 // Kernel heap
 void kernel_heap_init(void);
 
+// Compaction: migrate movable kernel-heap pages (4KB kmalloc_virtual()
+// mappings with a single reference) out of fragmented 2MB physical blocks
+// until `blocks` blocks are free, or as many as possible with 0. Returns
+// the number of blocks freed. Also run automatically when a large
+// alloc_pages() request fails.
+typedef struct {
+    uint32_t runs;
+    uint32_t auto_runs;         // Triggered by a failed allocation
+    uint32_t movable_pages;     // Found by the last run
+    uint64_t pages_migrated;
+    uint64_t blocks_freed;
+} paging_compact_stats_t;
+
+uint32_t paging_compact(uint32_t blocks);
+void paging_get_compact_stats(paging_compact_stats_t* stats);
+
+// Reclaim: a clock sweep over KV_RECLAIM ranges compresses pages whose
+// accessed bit stayed clear since the last pass into zram and frees their
+// frames; touching one faults it back in. Runs when an allocation fails
+// and at idle below RECLAIM_LOW_PAGES free pages.
+#define RECLAIM_LOW_PAGES   512
+#define RECLAIM_IDLE_BATCH  16
+
+typedef struct {
+    uint32_t runs;
+    uint64_t scanned;           // Resident pages the clock hand passed
+    uint64_t second_chances;    // ... that had been accessed since
+    uint64_t pages_reclaimed;
+    uint64_t faults;            // Pages decompressed on access
+    uint64_t fault_cycles;      // Total cycles spent in those faults
+} paging_reclaim_stats_t;
+
+// Free up to `pages` frames; returns how many were freed
+uint32_t paging_reclaim(uint32_t pages);
+
+// Same, but only from the KV_RECLAIM allocation that starts at `start`
+uint32_t paging_reclaim_range(const void* start, uint32_t pages);
+void paging_reclaim_idle(void);
+void paging_get_reclaim_stats(paging_reclaim_stats_t* stats);
+
+// kmalloc_virtual() address space usage
+void paging_get_vmem_stats(vmem_stats_t* stats);
+
+// Address-space switch cost: each iteration switches to a scratch
+// directory, touches `pages` of its private (non-global) 4KB pages, then
+// switches back and touches `pages` global kernel pages
+typedef struct {
+    uint32_t iterations;
+    uint32_t pages;
+    uint64_t full_flush;        // CR3 load with global pages dropped as well
+    uint64_t cr3_reload;        // CR3 load, global kernel entries kept
+    uint64_t pcid;              // No-flush CR3 load with PCIDs (0 if unsupported)
+} paging_switch_bench_t;        // Cycles per round trip
+
+int paging_switch_benchmark(uint32_t iterations, uint32_t pages, paging_switch_bench_t* result);
+
 // Statistics
 void paging_get_stats(uint64_t* total_virtual, uint64_t* used_virtual, 
                       uint64_t* total_physical, uint64_t* used_physical);
@@ -122,6 +277,16 @@ static inline uint64_t read_cr3(void) {
     return cr3;
 }
 
+static inline uint64_t read_cr4(void) {
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint64_t cr4) {
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
 static inline uint64_t read_cr2(void) {
     uint64_t cr2;
     __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
@@ -6,12 +6,113 @@
 #define PAGE_SIZE 4096
 #define KERNEL_PHYSICAL_START 0x100000  // 1MB
 
+// Buddy allocator: largest block is 2^PMM_MAX_ORDER pages (1 GB)
+#define PMM_MAX_ORDER 18
+
+// Physical zones. Allocations prefer NORMAL, then HIGH; DMA is only used
+// when asked for explicitly or when everything else is exhausted.
+#define PMM_ZONE_DMA     0   // Below 1 MB
+#define PMM_ZONE_NORMAL  1   // 1 MB - 4 GB
+#define PMM_ZONE_HIGH    2   // 4 GB and up
+#define PMM_ZONE_COUNT   3
+
+// Page frame numbers are 32-bit: up to 16 TB of physical memory
+#define PMM_MAX_PFN      0xFFFFFFFFULL
+
+typedef struct {
+    const char* name;
+    uint64_t start;             // Physical span of the zone
+    uint64_t end;
+    uint32_t managed_pages;     // Usable RAM pages in the zone
+    uint32_t free_pages;
+} pmm_zone_info_t;
+
+// Per-frame descriptor, one per PFN below the top of RAM. 16 bytes for a
+// 4KB frame keeps the array at 0.4% of the memory it describes.
+typedef struct {
+    uint32_t lru_next;          // PFN links while on a page_lru_t
+    uint32_t lru_prev;
+    uint32_t refcount;          // 0 = free or reserved
+    uint16_t flags;             // PF_*
+    uint8_t  zone;              // PMM_ZONE_*
+    uint8_t  owner;             // PAGE_OWNER_* of the current holder
+} page_frame_t;
+
+#define PFN_NONE            0xFFFFFFFFu
+
+#define PF_RESERVED         0x0001  // Firmware, kernel image or PMM metadata
+#define PF_LRU              0x0002  // Linked on a page_lru_t
+#define PF_MOVABLE          0x0004  // Compaction candidate; lru_next holds its VA >> 12
+
+#define PAGE_OWNER_NONE      0
+#define PAGE_OWNER_KERNEL    1      // Plain alloc_pages() caller
+#define PAGE_OWNER_PAGETABLE 2
+#define PAGE_OWNER_HEAP      3
+#define PAGE_OWNER_SLAB      4
+#define PAGE_OWNER_VMALLOC   5      // Mapped by kmalloc_virtual()
+#define PAGE_OWNER_USER      6
+
+// LRU list of frames, most recently added at the head
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t count;
+} page_lru_t;
+
+// Builds the zones from the bootloader's E820 map; memory_size (MB) is
+// only used when no map was handed over
 void physical_mm_init(uint32_t memory_size);
 void* alloc_page(void);
 void* alloc_pages(uint32_t count);
+void* alloc_pages_zone(uint32_t count, uint32_t zone);
 void free_page(void* page);
-uint32_t get_total_memory(void);
-uint32_t get_free_memory(void);
-uint32_t get_used_memory(void);
+void free_pages(void* base, uint32_t count);
+uint64_t get_total_memory(void);
+uint64_t get_free_memory(void);
+uint64_t get_used_memory(void);
+uint32_t pmm_get_free_blocks(uint32_t order);
+int pmm_get_zone_info(uint32_t zone, pmm_zone_info_t* info);
+uint32_t pmm_get_region_count(void);
+
+// Frame descriptors (NULL outside the array)
+page_frame_t* pfn_to_frame(uint32_t pfn);
+page_frame_t* phys_to_frame(uint64_t physical);
+
+// Reference counting. Frames come out of alloc_pages() with one reference;
+// put_page() frees the frame when the last one is dropped. page_ref_dec()
+// only drops it and leaves freeing to a caller that batches frees.
+void get_page(uint64_t physical);
+uint32_t put_page(uint64_t physical);
+uint32_t page_ref_dec(uint64_t physical);
+uint32_t page_ref_count(uint64_t physical);
+void page_set_owner(uint64_t physical, uint32_t count, uint32_t owner);
+
+void page_lru_init(page_lru_t* lru);
+void page_lru_add(page_lru_t* lru, uint64_t physical);
+void page_lru_del(page_lru_t* lru, uint64_t physical);
+uint64_t page_lru_tail(page_lru_t* lru);   // Least recent frame, 0 if empty
+
+// Descriptor array size
+void pmm_get_frame_stats(uint32_t* frames, uint64_t* bytes);
+
+// Compaction support. A 2MB block (PMM_COMPACT_PAGES pages) qualifies when
+// each page is free or PF_MOVABLE; the pick prefers the most free pages.
+// Isolating takes the block's free pages out of the allocator so the
+// migration cannot be handed pages of the block it is emptying.
+#define PMM_COMPACT_PAGES 512
+uint32_t pmm_compact_pick_block(void);
+uint32_t pmm_isolate_range(uint32_t pfn, uint32_t count);
+
+// Called by alloc_pages() when a request of PMM_COMPACT_PAGES or more
+// fails; asked for `blocks` free 2MB blocks, returns how many it freed
+void pmm_set_compact_handler(uint32_t (*handler)(uint32_t blocks));
+
+// Called first by alloc_pages() when any request fails; asked to free
+// `pages` frames, returns how many it freed
+void pmm_set_reclaim_handler(uint32_t (*handler)(uint32_t pages));
+
+// End of the highest usable page (size the physmap must cover)
+uint64_t pmm_get_phys_end(void);
+void pmm_get_scan_stats(uint64_t* allocations, uint64_t* words_scanned);
 
 #endif
@@ -0,0 +1,56 @@
+// src/include/memory/slab.h - Object caches for fixed-size kernel objects
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "../core/types.h"
+
+// Slab header, stored at the start of every slab. Slabs are naturally
+// aligned buddy blocks, so an object's slab is found by masking its address.
+typedef struct kmem_slab {
+    struct kmem_cache* cache;
+    struct kmem_slab* next;
+    struct kmem_slab* prev;
+    void* free_list;            // Free objects (next pointer stored in-object)
+    uint32_t in_use;            // Allocated objects in this slab
+    uint32_t list;              // Which cache list the slab is on
+} kmem_slab_t;
+
+typedef struct kmem_cache {
+    char name[24];
+    uint32_t obj_size;          // Object stride (size rounded up to alignment)
+    uint32_t objs_per_slab;
+    uint32_t slab_order;        // Slab is 2^slab_order pages
+    uint32_t first_offset;      // Offset of object 0 from the slab start
+    void (*ctor)(void* obj);    // Run once per object when a slab is created
+
+    kmem_slab_t* partial;       // Slabs with both free and used objects
+    kmem_slab_t* full;          // Slabs with no free objects
+    kmem_slab_t* empty;         // Fully free slabs kept for reuse
+
+    uint32_t num_slabs;
+    uint32_t num_empty;
+    uint32_t objs_in_use;
+    uint32_t total_allocs;
+
+    struct kmem_cache* next;    // Global cache list
+} kmem_cache_t;
+
+// Create a cache of objects of `size` bytes aligned to `align` (0 = 8).
+// `ctor` may be NULL.
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                void (*ctor)(void* obj));
+
+// Allocate / free one object
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+// Release every slab and the cache itself (all objects must be freed)
+void kmem_cache_destroy(kmem_cache_t* cache);
+
+// Return fully free slabs to the page allocator; returns pages released
+uint32_t kmem_cache_shrink(kmem_cache_t* cache);
+
+// Debug: print all caches
+void kmem_cache_debug_print(void);
+
+#endif // SLAB_H
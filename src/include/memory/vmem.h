@@ -0,0 +1,64 @@
+// src/include/memory/vmem.h - Coalescing virtual address space allocator
+#ifndef VMEM_H
+#define VMEM_H
+
+#include "../core/types.h"
+
+#define VMEM_FREELISTS   64     // Free segments segregated by power of two
+#define VMEM_HASH_SIZE   512    // Allocated segments, hashed by start
+
+// A segment is a span of the arena, free or allocated. All segments are
+// linked in address order so a freed span finds its neighbours in O(1).
+typedef struct vmem_seg {
+    uint64_t start;
+    uint64_t size;
+    struct vmem_seg* addr_next;
+    struct vmem_seg* addr_prev;
+    struct vmem_seg* list_next;     // Free list or hash chain
+    struct vmem_seg* list_prev;
+    uint32_t is_free;
+} vmem_seg_t;
+
+typedef struct {
+    char name[16];
+    uint64_t base;
+    uint64_t size;
+    uint64_t quantum;               // Allocation granule (power of two)
+
+    vmem_seg_t* segments;           // Lowest segment
+    vmem_seg_t* freelist[VMEM_FREELISTS];   // freelist[i]: size in [2^i, 2^(i+1))
+    uint64_t freemap;               // Bit i set if freelist[i] is non-empty
+    vmem_seg_t* hash[VMEM_HASH_SIZE];
+
+    uint64_t in_use;                // Bytes allocated
+    uint32_t num_segments;
+    uint32_t num_free_segments;
+    uint64_t allocs;
+    uint64_t frees;
+} vmem_t;
+
+typedef struct {
+    uint64_t total;
+    uint64_t in_use;
+    uint64_t largest_free;
+    uint32_t num_segments;
+    uint32_t num_free_segments;
+    uint64_t allocs;
+    uint64_t frees;
+} vmem_stats_t;
+
+// Manage [base, base + size); base and size must be quantum-aligned
+int vmem_init(vmem_t* vm, const char* name, uint64_t base, uint64_t size, uint64_t quantum);
+
+// Allocate size bytes aligned to align (0 = quantum); returns 0 on failure
+uint64_t vmem_alloc(vmem_t* vm, uint64_t size, uint64_t align);
+
+// Free an allocation by its start address; returns its size, 0 if unknown
+uint64_t vmem_free(vmem_t* vm, uint64_t addr);
+
+// Size of the allocation starting at addr, 0 if there is none
+uint64_t vmem_size(vmem_t* vm, uint64_t addr);
+
+void vmem_get_stats(vmem_t* vm, vmem_stats_t* stats);
+
+#endif // VMEM_H
@@ -0,0 +1,41 @@
+// src/include/memory/zero_pool.h - Pool of pre-zeroed physical pages
+#ifndef ZERO_POOL_H
+#define ZERO_POOL_H
+
+#include "../core/types.h"
+
+#define ZERO_POOL_SIZE    64    // Pages kept zeroed and ready
+#define ZERO_POOL_BATCH   8     // Pages zeroed per idle refill pass
+
+// alloc_pages_flags() flags
+#define ALLOC_ZERO        0x1   // Contents must be zero
+
+typedef struct {
+    uint32_t depth;             // Zeroed pages currently in the pool
+    uint32_t capacity;
+    uint64_t hits;              // Zeroed single pages served from the pool
+    uint64_t misses;            // ... that had to be zeroed inline
+    uint64_t pages_refilled;    // Pages zeroed in idle time
+    uint64_t refill_passes;     // Idle passes that zeroed at least one page
+    uint64_t pages_drained;     // Pages handed back to a failing allocation
+} zero_pool_stats_t;
+
+// Physical page(s) from the PMM. With ALLOC_ZERO a single page comes from
+// the pool when it has one; anything else is zeroed on the spot.
+void* alloc_pages_flags(uint32_t count, uint32_t flags);
+
+// Shorthand for alloc_pages_flags(1, ALLOC_ZERO)
+void* alloc_page_zeroed(void);
+
+// Idle hook: zero up to ZERO_POOL_BATCH pages into the pool. Skipped
+// below RECLAIM_LOW_PAGES free pages so the pool never competes with
+// reclaim for the last frames.
+void zero_pool_refill(void);
+
+// Return every pooled page to the PMM; returns how many were freed.
+// alloc_pages() calls this before reclaim or compaction.
+uint32_t zero_pool_drain(void);
+
+void zero_pool_get_stats(zero_pool_stats_t* stats);
+
+#endif // ZERO_POOL_H
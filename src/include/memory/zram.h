@@ -0,0 +1,32 @@
+// src/include/memory/zram.h - Compressed in-RAM store for evicted pages
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include "../core/types.h"
+
+#define ZRAM_MAX_SLOTS    4096              // Pages held at once (16 MB)
+#define ZRAM_MAX_STORED   (4096 * 3 / 4)    // Pages compressing worse stay resident
+
+typedef struct {
+    uint32_t stored_pages;      // Pages currently held
+    uint32_t zero_pages;        // ... of which all-zero (no pool space)
+    uint64_t orig_bytes;        // Uncompressed size of the held pages
+    uint64_t compr_bytes;       // Pool bytes they occupy
+    uint64_t stores;            // Pages compressed since boot
+    uint64_t rejects;           // Refused: incompressible, pool full or no memory
+    uint64_t loads;             // Pages decompressed back
+} zram_stats_t;
+
+// Compress one 4KB page into the pool. Returns its slot, or -1 if the page
+// should stay resident.
+int32_t zram_store(const void* page);
+
+// Decompress a slot into a 4KB page and release the slot
+int zram_load(uint32_t slot, void* page);
+
+// Release a slot without reading it back
+void zram_drop(uint32_t slot);
+
+void zram_get_stats(zram_stats_t* stats);
+
+#endif // ZRAM_H
@@ -190,8 +190,9 @@ int executable_run_object(
         return -1;
     }
 
-    // Note: process_start() needs to be implemented
-    // For now, just log that we would start it
+    // Not runnable until there is a ring 3 entry path; the scheduler would
+    // otherwise run the program's code in the kernel
+    proc->state = PROCESS_BLOCKED;
     terminal_writeln("exec: process created (start not yet implemented)");
 
     kfree(file_data);
@@ -0,0 +1,111 @@
+// src/kernel/core/fpu.c - Lazy FPU/SSE state switching
+#include "fpu.h"
+#include "process.h"
+#include "slab.h"
+#include "serial.h"
+
+#define CR0_MP  (1ULL << 1)
+#define CR0_EM  (1ULL << 2)
+#define CR0_TS  (1ULL << 3)
+#define CR0_NE  (1ULL << 5)
+
+#define CR4_OSFXSR      (1ULL << 9)
+#define CR4_OSXMMEXCPT  (1ULL << 10)
+
+#define MXCSR_DEFAULT   0x1F80  // All SSE exceptions masked
+
+// Thread whose state is in the registers; NULL when it belongs to nobody
+static process_t* fpu_owner = NULL;
+
+// FXSAVE areas, allocated on a thread's first #NM
+static kmem_cache_t* state_cache = NULL;
+
+static fpu_stats_t stats;
+
+static inline uint64_t read_cr0(void) {
+    uint64_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint64_t cr0) {
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+static inline void set_ts(void) {
+    uint64_t cr0 = read_cr0();
+    if (!(cr0 & CR0_TS)) write_cr0(cr0 | CR0_TS);
+}
+
+void fpu_init(void) {
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT));
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    __asm__ volatile("fninit");
+
+    state_cache = kmem_cache_create("fpu", FPU_STATE_SIZE, FPU_STATE_ALIGN, NULL);
+    fpu_owner = NULL;
+    set_ts();
+
+    kprintf("FPU: Lazy FXSAVE switching enabled\n");
+}
+
+void fpu_switch(process_t* next) {
+    if (next && next == fpu_owner) {
+        __asm__ volatile("clts");
+    } else {
+        set_ts();
+    }
+}
+
+void fpu_handle_nm(void) {
+    process_t* current = process_get_current();
+
+    __asm__ volatile("clts");
+    stats.traps++;
+    if (current == fpu_owner) return;
+
+    if (fpu_owner) {
+        __asm__ volatile("fxsave64 %0" : "=m"(*(uint8_t (*)[FPU_STATE_SIZE])fpu_owner->fpu_state));
+        stats.saves++;
+    }
+    fpu_owner = current;
+
+    // Kernel code outside a thread does not use vector registers; it
+    // gets a clean state that nobody saves
+    if (current && !current->fpu_state) {
+        current->fpu_state = state_cache ? kmem_cache_alloc(state_cache) : NULL;
+        if (!current->fpu_state) {
+            kprintf("FPU: No memory for PID=%d state\n", current->pid);
+            for (;;) {
+                __asm__ volatile("cli; hlt");
+            }
+        }
+    } else if (current) {
+        __asm__ volatile("fxrstor64 %0" : : "m"(*(const uint8_t (*)[FPU_STATE_SIZE])current->fpu_state));
+        stats.restores++;
+        return;
+    }
+
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    __asm__ volatile("fninit; ldmxcsr %0" : : "m"(mxcsr));
+    stats.inits++;
+}
+
+void fpu_release(process_t* proc) {
+    if (!proc) return;
+    if (fpu_owner == proc) {
+        fpu_owner = NULL;
+        set_ts();
+    }
+    if (proc->fpu_state) {
+        kmem_cache_free(state_cache, proc->fpu_state);
+        proc->fpu_state = NULL;
+    }
+}
+
+void fpu_get_stats(fpu_stats_t* out) {
+    if (out) *out = stats;
+}
@@ -3,6 +3,7 @@
 #include "kstring.h"
 #include "serial.h"
 #include "paging.h"
+#include "fpu.h"
 
 static idt_entry_t idt[IDT_ENTRIES];
 static idt_ptr_t idt_ptr;
@@ -115,6 +116,12 @@ void isr_handler(uint64_t int_no, uint64_t err_code) {
         return;
     }
 
+    // Device not available: first FPU/SSE use since the last switch
+    if (int_no == 7) {
+        fpu_handle_nm();
+        return;
+    }
+
     // General exception handler
     kprintf("\n!!! EXCEPTION: %s !!!\n", exception_messages[int_no]);
     kprintf("Interrupt: %d, Error Code: 0x%llx\n", (uint32_t)int_no, err_code);
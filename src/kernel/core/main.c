@@ -4,6 +4,7 @@
 #include "system.h"
 #include "shell.h"
 #include "keyboard.h"
+#include "timer.h"
 #include "heap.h"
 #include "exfat.h"
 #include "metafs.h"
@@ -47,12 +48,16 @@ void os_main(void) {
     
     keyboard_init();
     terminal_write(" [KB]");
+
+    timer_init(TIMER_HZ);
+    terminal_write(" [PIT]");
     
     while (inb(0x64) & 0x01) {
         inb(0x60);
     }
     
     exfat_volume_t* volume = (exfat_volume_t*)kmalloc(sizeof(exfat_volume_t));
+    memset(volume, 0, sizeof(exfat_volume_t));
     terminal_write(".");
     
     // System boot handles logger initialization internally now
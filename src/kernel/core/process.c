@@ -4,6 +4,10 @@
 #include "kstring.h"
 #include "serial.h"
 #include "paging.h"
+#include "slab.h"
+#include "physical_mm.h"
+#include "kzone.h"
+#include "fpu.h"
 
 static process_t* process_list = NULL;
 static process_t* current_process = NULL;
@@ -12,6 +16,39 @@ static uint32_t next_pid = 1;
 // Process queue management
 static process_t* ready_queue = NULL;
 
+// PCBs come from their own slab cache
+static kmem_cache_t* process_cache = NULL;
+
+// Kernel stacks are charged here; the quota covers MAX_PROCESSES of them
+static kzone_t* stack_zone = NULL;
+
+// Where the kernel was running before the first switch; resumed when no
+// process is ready
+static cpu_context_t boot_context;
+static uint64_t switch_count = 0;
+
+// switch_asm.asm
+extern void context_switch(cpu_context_t* old_context, cpu_context_t* new_context);
+extern void process_trampoline(void);
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// A new thread enters process_trampoline on its own kernel stack with the
+// entry point in r12. User processes run their entry there too until
+// there is a ring 3 entry path.
+static void context_init(process_t* proc) {
+    memset(&proc->context, 0, sizeof(cpu_context_t));
+    proc->context.rip = (uint64_t)process_trampoline;
+    proc->context.r12 = (uint64_t)proc->entry_point;
+    proc->context.rsp = proc->kernel_stack;
+    proc->context.rflags = 0x202;                   // IF enabled
+    proc->context.cr3 = virt_to_phys(proc->page_dir);
+}
+
 void process_init(void) {
     kprintf("PROCESS: Initializing process management...\n");
 
@@ -27,7 +64,14 @@ process_t* process_create(const char* name, void (*entry_point)(void), uint32_t
     kprintf("PROCESS: Creating process '%s'...\n", name);
 
     // Allocate PCB
-    process_t* proc = (process_t*)kmalloc(sizeof(process_t));
+    if (!process_cache) {
+        process_cache = kmem_cache_create("process", sizeof(process_t), 16, NULL);
+        fpu_init();
+    }
+    if (!stack_zone) {
+        stack_zone = kzone_create("kstacks", (uint64_t)MAX_PROCESSES * 8192);
+    }
+    process_t* proc = (process_t*)kmem_cache_alloc(process_cache);
     if (!proc) {
         kprintf("PROCESS: Failed to allocate PCB\n");
         return NULL;
@@ -41,54 +85,66 @@ process_t* process_create(const char* name, void (*entry_point)(void), uint32_t
         proc->name[i] = name[i];
     }
     proc->state = PROCESS_READY;
+    proc->entry_point = entry_point;
     proc->priority = 10;
     proc->time_slice = 10;
 
     // Create page directory
     if (!is_kernel) {
-        proc->page_dir = (page_directory_t*)kmalloc_virtual(sizeof(page_directory_t));
+        proc->page_dir = (page_directory_t*)kmalloc_virtual_flags(sizeof(page_directory_t), KV_PINNED);
         if (!proc->page_dir) {
             kprintf("PROCESS: Failed to allocate page directory\n");
-            kfree(proc);
+            kmem_cache_free(process_cache, proc);
             return NULL;
         }
 
         // Copy kernel mappings to new page directory
         memcpy(proc->page_dir, get_kernel_page_dir(), sizeof(page_directory_t));
+        proc->pcid = paging_alloc_pcid();
     } else {
         proc->page_dir = get_kernel_page_dir();
     }
 
     // Allocate kernel stack (8KB) - CHANGED to uint64_t
-    proc->kernel_stack = (uint64_t)kmalloc_virtual(8192);
+    proc->kernel_stack = (uint64_t)kzone_alloc_virtual(stack_zone, 8192, KV_PINNED);
     if (!proc->kernel_stack) {
         kprintf("PROCESS: Failed to allocate kernel stack\n");
-        if (!is_kernel) kfree_virtual(proc->page_dir, sizeof(page_directory_t));
-        kfree(proc);
+        if (!is_kernel) {
+            kfree_virtual(proc->page_dir, sizeof(page_directory_t));
+            paging_free_pcid(proc->pcid);
+        }
+        kmem_cache_free(process_cache, proc);
         return NULL;
     }
     proc->kernel_stack += 8192;  // Stack grows down
 
-    // Allocate user stack (8KB) if user mode - CHANGED to uint64_t
+    // Map the user stack (8KB) into the process's own lower half
     if (!is_kernel) {
-        proc->user_stack = (uint64_t)kmalloc_virtual(8192);
-        if (!proc->user_stack) {
+        uint64_t stack_base = USER_STACK_TOP - PROCESS_STACK_SIZE;
+        void* frames = alloc_pages(PROCESS_STACK_SIZE / PAGE_SIZE);
+        if (frames) {
+            page_set_owner((uint64_t)(uintptr_t)frames, PROCESS_STACK_SIZE / PAGE_SIZE,
+                           PAGE_OWNER_USER);
+        }
+        if (!frames ||
+            map_range(proc->page_dir, stack_base, (uint64_t)(uintptr_t)frames,
+                      PROCESS_STACK_SIZE, PAGE_WRITABLE | PAGE_USER) < 0) {
             kprintf("PROCESS: Failed to allocate user stack\n");
-            kfree_virtual((void*)(proc->kernel_stack - 8192), 8192);
+            if (frames) {
+                unmap_range(proc->page_dir, stack_base, PROCESS_STACK_SIZE, 0);
+                free_pages(frames, PROCESS_STACK_SIZE / PAGE_SIZE);
+            }
+            paging_free_user_tables(proc->page_dir);
+            kzone_free_virtual(stack_zone, (void*)(proc->kernel_stack - 8192), 8192);
             kfree_virtual(proc->page_dir, sizeof(page_directory_t));
-            kfree(proc);
+            paging_free_pcid(proc->pcid);
+            kmem_cache_free(process_cache, proc);
             return NULL;
         }
-        proc->user_stack += 8192;  // Stack grows down
+        proc->user_stack = USER_STACK_TOP;  // Stack grows down
     }
 
-    // Initialize context - CHANGED for 64-bit registers
-    memset(&proc->context, 0, sizeof(cpu_context_t));
-    proc->context.rip = (uint64_t)entry_point;      // CHANGED: eip -> rip
-    proc->context.rsp = is_kernel ? proc->kernel_stack : proc->user_stack;  // CHANGED: esp -> rsp
-    proc->context.rbp = proc->context.rsp;          // CHANGED: ebp -> rbp
-    proc->context.rflags = 0x202;                   // CHANGED: eflags -> rflags (IF enabled)
-    proc->context.cr3 = (uint64_t)proc->page_dir;   // CHANGED: 64-bit
+    context_init(proc);
 
     // Add to process list
     proc->next = process_list;
@@ -104,17 +160,21 @@ void process_destroy(process_t* proc) {
 
     kprintf("PROCESS: Destroying process PID=%d '%s'\n", proc->pid, proc->name);
 
+    fpu_release(proc);
+
     // Free stacks
     if (proc->kernel_stack) {
-        kfree_virtual((void*)(proc->kernel_stack - 8192), 8192);
-    }
-    if (proc->user_stack) {
-        kfree_virtual((void*)(proc->user_stack - 8192), 8192);
+        kzone_free_virtual(stack_zone, (void*)(proc->kernel_stack - 8192), 8192);
     }
 
-    // Free page directory (if not kernel)
+    // Free page directory (if not kernel). The user stack and any other
+    // private mapping drop their frame references, so frames still shared
+    // with a clone stay alive.
     if (proc->page_dir != get_kernel_page_dir()) {
+        paging_unmap_user(proc->page_dir);
+        paging_free_user_tables(proc->page_dir);
         kfree_virtual(proc->page_dir, sizeof(page_directory_t));
+        paging_free_pcid(proc->pcid);
     }
 
     // Remove from process list
@@ -128,11 +188,60 @@ void process_destroy(process_t* proc) {
     }
 
     // Free PCB
-    kfree(proc);
+    kmem_cache_free(process_cache, proc);
 }
 
-// Context switch assembly (simplified - you'd implement this in assembly)
-extern void context_switch(cpu_context_t* old_context, cpu_context_t* new_context);
+process_t* process_clone(process_t* parent) {
+    if (!parent) return NULL;
+    if (parent->page_dir == get_kernel_page_dir()) {
+        kprintf("PROCESS: Cannot clone kernel process PID=%d\n", parent->pid);
+        return NULL;
+    }
+
+    process_t* child = (process_t*)kmem_cache_alloc(process_cache);
+    if (!child) {
+        kprintf("PROCESS: Failed to allocate PCB\n");
+        return NULL;
+    }
+    memcpy(child, parent, sizeof(process_t));
+    child->pid = next_pid++;
+    child->state = PROCESS_READY;
+    child->kernel_stack = 0;
+    child->fpu_state = NULL;
+
+    child->page_dir = (page_directory_t*)kmalloc_virtual_flags(sizeof(page_directory_t), KV_PINNED);
+    if (!child->page_dir) {
+        kprintf("PROCESS: Failed to allocate page directory\n");
+        kmem_cache_free(process_cache, child);
+        return NULL;
+    }
+    memcpy(child->page_dir, get_kernel_page_dir(), sizeof(page_directory_t));
+    child->pcid = paging_alloc_pcid();
+
+    child->kernel_stack = (uint64_t)kzone_alloc_virtual(stack_zone, 8192, KV_PINNED);
+    if (!child->kernel_stack ||
+        paging_clone_user(child->page_dir, parent->page_dir) < 0) {
+        kprintf("PROCESS: Failed to clone PID=%d\n", parent->pid);
+        if (child->kernel_stack) kzone_free_virtual(stack_zone, (void*)child->kernel_stack, 8192);
+        paging_unmap_user(child->page_dir);
+        paging_free_user_tables(child->page_dir);
+        kfree_virtual(child->page_dir, sizeof(page_directory_t));
+        paging_free_pcid(child->pcid);
+        kmem_cache_free(process_cache, child);
+        return NULL;
+    }
+    child->kernel_stack += 8192;  // Stack grows down
+
+    // The parent's saved registers point into its own kernel stack, so
+    // the child starts from the entry point, in its own address space
+    context_init(child);
+
+    child->next = process_list;
+    process_list = child;
+
+    kprintf("PROCESS: Cloned PID=%d '%s' as PID=%d\n", parent->pid, parent->name, child->pid);
+    return child;
+}
 
 void process_switch(process_t* next) {
     if (!next || next == current_process) return;
@@ -140,19 +249,41 @@ void process_switch(process_t* next) {
     process_t* old = current_process;
     current_process = next;
 
-    kprintf("PROCESS: Switching from PID=%d to PID=%d\n",
-            old ? old->pid : 0, next->pid);
-
-    // Update states
-    if (old) old->state = PROCESS_READY;
+    // Update states; a blocked or exiting thread keeps its state
+    if (old && old->state == PROCESS_RUNNING) old->state = PROCESS_READY;
     next->state = PROCESS_RUNNING;
 
-    // Switch page directory
-    switch_page_directory(next->page_dir);
+    // Switch page directory; with PCIDs the TLB keeps next's entries
+    if (!old || old->page_dir != next->page_dir) {
+        switch_page_directory_pcid(next->page_dir, next->pcid);
+    }
+
+    fpu_switch(next);
+    switch_count++;
+    context_switch(old ? &old->context : &boot_context, &next->context);
+}
+
+// Nothing is ready: back to the kernel context that made the first switch
+static void switch_to_boot(void) {
+    process_t* old = current_process;
+    current_process = NULL;
+
+    if (old->page_dir != get_kernel_page_dir()) {
+        switch_page_directory(get_kernel_page_dir());
+    }
+
+    fpu_switch(NULL);
+    switch_count++;
+    context_switch(&old->context, &boot_context);
+}
+
+void process_exit(void) {
+    process_t* proc = current_process;
+    if (!proc) return;
 
-    // Context switch (would be in assembly)
-    // For now, just update RIP and continue
-    // In real implementation, save/restore all registers
+    // The kernel stack is still in use; process_destroy() frees it later
+    proc->state = PROCESS_TERMINATED;
+    schedule();
 }
 
 process_t* process_get_current(void) {
@@ -166,20 +297,23 @@ void scheduler_init(void) {
 }
 
 void schedule(void) {
-    // Find next ready process
+    // Find the next ready process after the current one, wrapping around
+    process_t* start = current_process ? current_process->next : process_list;
     process_t* next = NULL;
-    process_t* current = process_list;
 
-    while (current) {
-        if (current->state == PROCESS_READY) {
-            next = current;
-            break;
-        }
-        current = current->next;
+    for (process_t* p = start; p && !next; p = p->next) {
+        if (p->state == PROCESS_READY) next = p;
+    }
+    for (process_t* p = process_list; p != start && !next; p = p->next) {
+        if (p->state == PROCESS_READY) next = p;
     }
 
-    if (next) {
+    if (next == current_process && next) {
+        next->state = PROCESS_RUNNING;
+    } else if (next) {
         process_switch(next);
+    } else if (current_process && current_process->state != PROCESS_RUNNING) {
+        switch_to_boot();
     }
 }
 
@@ -219,3 +353,50 @@ void test_process_2(void) {
 
     kprintf("TEST_PROCESS_2: Exiting\n");
 }
+
+static volatile uint32_t bench_rounds;
+static volatile int bench_fpu;
+
+static void bench_thread(void) {
+    for (uint32_t i = 0; i < bench_rounds; i++) {
+        if (bench_fpu) {
+            __asm__ volatile("pxor %%xmm0, %%xmm0" : : : "memory");
+        }
+        yield();
+    }
+}
+
+int process_switch_benchmark(uint32_t rounds, int use_fpu, process_switch_bench_t* out) {
+    if (!out || !rounds || current_process) return -1;
+
+    process_t* a = process_create("bench-a", bench_thread, 1);
+    process_t* b = process_create("bench-b", bench_thread, 1);
+    if (!a || !b) {
+        process_destroy(a);
+        process_destroy(b);
+        return -1;
+    }
+
+    bench_rounds = rounds;
+    bench_fpu = use_fpu;
+
+    fpu_stats_t fpu_before, fpu_after;
+    fpu_get_stats(&fpu_before);
+    uint64_t switches = switch_count;
+    uint64_t start = rdtsc();
+
+    // Returns here once both threads have exited
+    schedule();
+
+    uint64_t cycles = rdtsc() - start;
+    switches = switch_count - switches;
+    fpu_get_stats(&fpu_after);
+
+    process_destroy(a);
+    process_destroy(b);
+
+    out->switches = (uint32_t)switches;
+    out->cycles = switches ? cycles / switches : 0;
+    out->fpu_traps = fpu_after.traps - fpu_before.traps;
+    return 0;
+}
@@ -2,6 +2,10 @@
 #include "keyboard.h"
 #include "io.h"
 #include "idt.h"
+#include "zero_pool.h"
+#include "paging.h"
+#include "kzone.h"
+#include "timer.h"
 
 #define KEYBOARD_DATA_PORT   0x60
 #define KEYBOARD_STATUS_PORT 0x64
@@ -119,10 +123,20 @@ int keyboard_available(void) {
     return kb_read_pos != kb_write_pos;
 }
 
+// Idle while waiting for a key: top up the zeroed page pool, relieve
+// memory pressure, then sleep until the next interrupt (tickless)
+static void keyboard_idle(void) {
+    zero_pool_refill();
+    paging_reclaim_idle();
+    kzone_check_watermark();
+    if (keyboard_available()) return;
+    timer_idle();
+}
+
 // Get next key (blocking)
 uint8_t keyboard_getkey(void) {
     while (!keyboard_available()) {
-        __asm__ volatile("hlt");  // Wait for interrupt
+        keyboard_idle();
     }
     
     uint8_t scancode = keyboard_buffer[kb_read_pos];
@@ -162,13 +176,14 @@ int keyboard_readline(char* buffer, int max_len) {
     __asm__ volatile("cli");
     
     while (1) {
-        // Poll keyboard status port to see if data is available
-        while (!(inb(0x64) & 0x01)) {
-            __asm__ volatile("pause");  // Hint to CPU we're spinning
+        // Wait for a scancode on the port, or one the IRQ handler
+        // buffered while we slept
+        while (!(inb(0x64) & 0x01) && !keyboard_available()) {
+            keyboard_idle();
+            __asm__ volatile("cli");
         }
         
-        // Read scancode directly from port
-        uint8_t scancode = inb(0x60);
+        uint8_t scancode = keyboard_available() ? keyboard_getkey() : inb(0x60);
         
         // Handle special keys
         if (scancode == 0x0E) {  // Backspace
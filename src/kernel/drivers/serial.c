@@ -67,6 +67,32 @@ void serial_put_dec(uint32_t val) {
     }
 }
 
+void serial_put_hex64(uint64_t val) {
+    char hex[] = "0123456789ABCDEF";
+    serial_puts("0x");
+    for (int i = 60; i >= 0; i -= 4) {
+        serial_putc(hex[(val >> i) & 0xF]);
+    }
+}
+
+void serial_put_dec64(uint64_t val) {
+    if (val == 0) {
+        serial_putc('0');
+        return;
+    }
+
+    char buf[24];
+    int i = 0;
+    while (val > 0 && i < 23) {
+        buf[i++] = '0' + (val % 10);
+        val /= 10;
+    }
+
+    while (i > 0) {
+        serial_putc(buf[--i]);
+    }
+}
+
 // FIXED: Simple printf implementation with better safety
 void kprintf(const char* format, ...) {
     if (!format) return;
@@ -78,16 +104,30 @@ void kprintf(const char* format, ...) {
     while (*format) {
         if (*format == '%' && *(format + 1)) {
             format++;
+
+            // 'l' / 'll' take a 64-bit argument
+            int is_long = 0;
+            while (*format == 'l' && *(format + 1)) {
+                is_long = 1;
+                format++;
+            }
+
             switch (*format) {
                 case 'd':
                 case 'u': {
-                    uint32_t val = __builtin_va_arg(args, uint32_t);
-                    serial_put_dec(val);
+                    if (is_long) {
+                        serial_put_dec64(__builtin_va_arg(args, uint64_t));
+                    } else {
+                        serial_put_dec(__builtin_va_arg(args, uint32_t));
+                    }
                     break;
                 }
                 case 'x': {
-                    uint32_t val = __builtin_va_arg(args, uint32_t);
-                    serial_put_hex(val);
+                    if (is_long) {
+                        serial_put_hex64(__builtin_va_arg(args, uint64_t));
+                    } else {
+                        serial_put_hex(__builtin_va_arg(args, uint32_t));
+                    }
                     break;
                 }
                 case 's': {
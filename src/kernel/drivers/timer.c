@@ -0,0 +1,206 @@
+// src/kernel/drivers/timer.c - PIT system tick with tickless idle
+#include "timer.h"
+#include "io.h"
+#include "idt.h"
+#include "serial.h"
+
+#define PIT_CHANNEL0        0x40
+#define PIT_COMMAND         0x43
+#define PIT_MODE_ONESHOT    0x30    // Channel 0, lo/hi byte, mode 0
+#define PIT_MODE_PERIODIC   0x34    // Channel 0, lo/hi byte, mode 2
+#define PIT_LATCH           0x00    // Latch channel 0 count
+
+#define PIC1_COMMAND        0x20
+#define PIC1_DATA           0x21
+#define PIC_READ_IRR        0x0A
+
+volatile uint64_t jiffies = 0;
+
+static uint32_t timer_hz = 0;
+static uint32_t tick_cycles = 0;        // PIT cycles per tick
+static uint32_t cycle_remainder = 0;    // Slept cycles short of a whole tick
+
+// Length of the armed one-shot, 0 while periodic. An expiry that
+// timer_idle() already accounted leaves its IRQ pending as stale.
+static volatile uint32_t oneshot_cycles = 0;
+static volatile int stale_irq = 0;
+
+// Armed events, earliest first
+static timer_event_t* events = NULL;
+
+static timer_stats_t stats;
+
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    if (flags & 0x200) __asm__ volatile("sti" : : : "memory");
+}
+
+static void pit_program(uint8_t mode, uint32_t count) {
+    outb(PIT_COMMAND, mode);
+    outb(PIT_CHANNEL0, (uint8_t)count);
+    outb(PIT_CHANNEL0, (uint8_t)(count >> 8));
+}
+
+static uint32_t pit_read_count(void) {
+    outb(PIT_COMMAND, PIT_LATCH);
+    uint32_t lo = inb(PIT_CHANNEL0);
+    uint32_t hi = inb(PIT_CHANNEL0);
+    return lo | (hi << 8);
+}
+
+static int irq0_pending(void) {
+    outb(PIC1_COMMAND, PIC_READ_IRR);
+    return inb(PIC1_COMMAND) & 0x01;
+}
+
+// Turn PIT cycles spent off the periodic tick into jiffies
+static void account_cycles(uint32_t cycles) {
+    cycle_remainder += cycles;
+    while (cycle_remainder >= tick_cycles) {
+        cycle_remainder -= tick_cycles;
+        jiffies++;
+        stats.idle_ticks++;
+    }
+}
+
+static void run_expired(void) {
+    while (events && events->expires <= jiffies) {
+        timer_event_t* event = events;
+        events = event->next;
+        event->next = NULL;
+        event->pending = 0;
+        event->callback(event->arg);
+    }
+}
+
+void timer_init(uint32_t hz) {
+    extern void irq0_handler(void);
+
+    if (hz < PIT_FREQUENCY / 0xFFFF + 1) hz = PIT_FREQUENCY / 0xFFFF + 1;
+    if (hz > PIT_FREQUENCY / 2) hz = PIT_FREQUENCY / 2;
+
+    timer_hz = hz;
+    tick_cycles = (PIT_FREQUENCY + hz / 2) / hz;
+    stats.hz = hz;
+
+    pit_program(PIT_MODE_PERIODIC, tick_cycles);
+
+    // IRQ0 = interrupt 32 after the PIC remap
+    idt_set_gate(32, (uint64_t)irq0_handler, 0x08, 0x8E);
+    outb(PIC1_DATA, inb(PIC1_DATA) & ~0x01);
+
+    kprintf("TIMER: PIT at %u Hz (%u cycles per tick)\n", hz, tick_cycles);
+}
+
+uint32_t timer_get_hz(void) {
+    return timer_hz;
+}
+
+uint64_t timer_uptime_ms(void) {
+    return timer_hz ? jiffies * 1000 / timer_hz : 0;
+}
+
+void timer_add(timer_event_t* event, uint64_t delay, void (*callback)(void* arg), void* arg) {
+    if (!event || !callback) return;
+
+    uint64_t flags = irq_save();
+    if (event->pending) timer_cancel(event);
+
+    event->expires = jiffies + delay;
+    event->callback = callback;
+    event->arg = arg;
+    event->pending = 1;
+
+    timer_event_t** link = &events;
+    while (*link && (*link)->expires <= event->expires) {
+        link = &(*link)->next;
+    }
+    event->next = *link;
+    *link = event;
+    irq_restore(flags);
+}
+
+void timer_cancel(timer_event_t* event) {
+    if (!event) return;
+
+    uint64_t flags = irq_save();
+    for (timer_event_t** link = &events; *link; link = &(*link)->next) {
+        if (*link == event) {
+            *link = event->next;
+            break;
+        }
+    }
+    event->next = NULL;
+    event->pending = 0;
+    irq_restore(flags);
+}
+
+void timer_handler(void) {
+    if (stale_irq) {
+        stale_irq = 0;
+        return;
+    }
+
+    stats.interrupts++;
+    if (oneshot_cycles) {
+        // Idle sleep ran to its deadline: back to periodic ticks
+        account_cycles(oneshot_cycles);
+        oneshot_cycles = 0;
+        pit_program(PIT_MODE_PERIODIC, tick_cycles);
+    } else {
+        jiffies++;
+    }
+    run_expired();
+}
+
+void timer_idle(void) {
+    __asm__ volatile("cli");
+
+    uint32_t cycles = 0;
+    uint64_t ticks = ~0ULL;
+    if (events) {
+        ticks = events->expires > jiffies ? events->expires - jiffies : 0;
+    }
+
+    // A tick already pending would be mistaken for the one-shot's expiry
+    if (timer_hz && ticks > 1 && !irq0_pending()) {
+        // Keep the part of the current tick that has already passed
+        account_cycles(tick_cycles - pit_read_count());
+
+        cycles = TIMER_ONESHOT_MAX;
+        if (ticks < TIMER_ONESHOT_MAX / tick_cycles) {
+            cycles = (uint32_t)ticks * tick_cycles;
+        }
+        oneshot_cycles = cycles;
+        pit_program(PIT_MODE_ONESHOT, cycles);
+        stats.idle_sleeps++;
+    }
+
+    __asm__ volatile("sti; hlt" : : : "memory");
+    if (!cycles) return;
+
+    __asm__ volatile("cli");
+    if (oneshot_cycles) {
+        // Another interrupt woke us first. Mode 0 keeps counting down
+        // through zero, so a count above the start means it expired too.
+        uint32_t remaining = pit_read_count();
+        int expired = irq0_pending() || remaining == 0 || remaining > cycles;
+
+        account_cycles(expired ? cycles : cycles - remaining);
+        oneshot_cycles = 0;
+        stale_irq = expired;
+        pit_program(PIT_MODE_PERIODIC, tick_cycles);
+        stats.early_wakeups++;
+        run_expired();
+    }
+    __asm__ volatile("sti");
+}
+
+void timer_get_stats(timer_stats_t* out) {
+    if (out) *out = stats;
+}
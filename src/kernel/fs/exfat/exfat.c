@@ -5,10 +5,17 @@
 #include "kstring.h"
 #include "heap.h"
 #include "dma.h"
+#include "kzone.h"
+#include "zram.h"
 // Memory-based disk for testing
 static uint8_t* disk_buffer = NULL;
 static uint32_t disk_size_sectors = 0;
 static int paging_is_enabled = 0;
+
+// Disk buffer, buffer pool and pool-miss buffers are charged here. The
+// quota is the disk plus EXFAT_ZONE_SLACK for buffers.
+#define EXFAT_ZONE_SLACK (4ULL * 1024 * 1024)
+static kzone_t* exfat_zone = NULL;
 // Use DMA-allocated buffer instead of static array
 static uint8_t* sector_buffer = NULL;
 
@@ -24,20 +31,42 @@ void exfat_init_dma(void) {
     }
 }
 
+// Memory pressure: compress cold disk sectors out to zram. Only the disk
+// buffer's own pages are swept, and the heap bytes the compressed copies
+// take are subtracted from what is reported freed.
+static uint64_t exfat_zone_reclaim(kzone_t* zone, uint64_t bytes) {
+    (void)zone;
+    if (!disk_buffer || !paging_is_enabled) return 0;
+
+    zram_stats_t before, after;
+    zram_get_stats(&before);
+    uint32_t pages = (uint32_t)((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    uint64_t freed = (uint64_t)paging_reclaim_range(disk_buffer, pages) * PAGE_SIZE;
+    zram_get_stats(&after);
+
+    uint64_t stored = after.compr_bytes - before.compr_bytes;
+    return freed > stored ? freed - stored : 0;
+}
+
 // Modified initialization function
 void exfat_init_disk(uint32_t size_mb) {
     disk_size_sectors = (size_mb * 1024 * 1024) / 512;
     uint32_t total_bytes = disk_size_sectors * 512;
 
+    exfat_zone = kzone_create("exfat", total_bytes + EXFAT_ZONE_SLACK);
+    kzone_set_reclaim(exfat_zone, exfat_zone_reclaim);
+
     kprintf("EXFAT: Allocating %d MB disk buffer...\n", size_mb);
 
-    // Use appropriate allocation method
+    // Reserve the address space only; sectors get a zeroed frame the
+    // first time they are touched, so resident size follows what is used.
+    // Cold sectors are compressed to zram when memory runs short. The
+    // zone is charged the whole reservation, not what is resident.
     if (paging_is_enabled) {
-        // After paging: use virtual heap (can handle large allocations)
-        disk_buffer = (uint8_t*)kmalloc_virtual(total_bytes);
+        disk_buffer = (uint8_t*)kzone_alloc_virtual(exfat_zone, total_bytes,
+                                                    KV_LAZY | KV_RECLAIM);
     } else {
-        // Before paging: use regular heap (limited by identity mapping)
-        disk_buffer = (uint8_t*)kmalloc(total_bytes);
+        disk_buffer = (uint8_t*)kzone_alloc(exfat_zone, total_bytes);
     }
 
     if (!disk_buffer) {
@@ -235,6 +264,89 @@ int exfat_format(uint32_t total_sectors) {
     return 0;
 }
 
+// ===== Per-volume buffer pool =====
+
+static void exfat_pool_release(exfat_volume_t* volume) {
+    exfat_buffer_pool_t* pool = &volume->pool;
+
+    kzone_free(exfat_zone, pool->cluster_memory);
+    kzone_free(exfat_zone, pool->sector_memory);
+    memset(pool, 0, sizeof(exfat_buffer_pool_t));
+}
+
+// Preallocate the pool once the volume geometry is known. The volume
+// structure must start out zeroed; a remount replaces the old pool.
+static void exfat_pool_init(exfat_volume_t* volume) {
+    exfat_buffer_pool_t* pool = &volume->pool;
+
+    exfat_pool_release(volume);
+
+    pool->cluster_memory = (uint8_t*)kzone_alloc(
+        exfat_zone, EXFAT_POOL_CLUSTERS * volume->bytes_per_cluster);
+    pool->sector_memory = (uint8_t*)kzone_alloc(
+        exfat_zone, EXFAT_POOL_SECTORS * volume->bytes_per_sector);
+
+    for (uint32_t i = 0; i < EXFAT_POOL_CLUSTERS && pool->cluster_memory; i++) {
+        pool->clusters[i].data = pool->cluster_memory + i * volume->bytes_per_cluster;
+    }
+    for (uint32_t i = 0; i < EXFAT_POOL_SECTORS && pool->sector_memory; i++) {
+        pool->sectors[i].data = pool->sector_memory + i * volume->bytes_per_sector;
+    }
+}
+
+static uint8_t* exfat_pool_get(exfat_volume_t* volume, exfat_buffer_t* buffers,
+                               uint32_t count, uint32_t size) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (buffers[i].data && buffers[i].refcount == 0) {
+            buffers[i].refcount = 1;
+            volume->pool.hits++;
+            return buffers[i].data;
+        }
+    }
+
+    // Pool exhausted (or never allocated): fall back to the heap
+    volume->pool.misses++;
+    return (uint8_t*)kzone_alloc(exfat_zone, size);
+}
+
+static exfat_buffer_t* exfat_pool_find(exfat_volume_t* volume, uint8_t* data) {
+    exfat_buffer_pool_t* pool = &volume->pool;
+
+    for (uint32_t i = 0; i < EXFAT_POOL_CLUSTERS; i++) {
+        if (pool->clusters[i].data == data) return &pool->clusters[i];
+    }
+    for (uint32_t i = 0; i < EXFAT_POOL_SECTORS; i++) {
+        if (pool->sectors[i].data == data) return &pool->sectors[i];
+    }
+    return NULL;
+}
+
+uint8_t* exfat_get_cluster_buffer(exfat_volume_t* volume) {
+    return exfat_pool_get(volume, volume->pool.clusters, EXFAT_POOL_CLUSTERS,
+                          volume->bytes_per_cluster);
+}
+
+uint8_t* exfat_get_sector_buffer(exfat_volume_t* volume) {
+    return exfat_pool_get(volume, volume->pool.sectors, EXFAT_POOL_SECTORS,
+                          volume->bytes_per_sector);
+}
+
+void exfat_put_buffer(exfat_volume_t* volume, uint8_t* data) {
+    if (!data) return;
+
+    exfat_buffer_t* buffer = exfat_pool_find(volume, data);
+    if (!buffer) {
+        kzone_free(exfat_zone, data);
+        return;
+    }
+
+    if (buffer->refcount == 0) {
+        kprintf("EXFAT: Buffer %x released twice\n", (uint32_t)(uintptr_t)data);
+        return;
+    }
+    buffer->refcount--;
+}
+
 // Mount an exFAT volume
 int exfat_mount(exfat_volume_t* volume) {
     kprintf("EXFAT: Mounting volume...\n");
@@ -273,6 +385,8 @@ int exfat_mount(exfat_volume_t* volume) {
     volume->cluster_heap_start_sector = volume->boot_sector.cluster_heap_offset;
     volume->root_dir_cluster = volume->boot_sector.root_dir_cluster;
 
+    exfat_pool_init(volume);
+
     kprintf("EXFAT: Volume mounted successfully\n");
     kprintf("  Bytes per sector: %d\n", volume->bytes_per_sector);
     kprintf("  Sectors per cluster: %d\n", volume->sectors_per_cluster);
@@ -283,6 +397,15 @@ int exfat_mount(exfat_volume_t* volume) {
     return 0;
 }
 
+// Release per-volume resources
+void exfat_unmount(exfat_volume_t* volume) {
+    if (!volume) return;
+
+    kprintf("EXFAT: Unmounting volume (buffer pool: %d hits, %d misses)\n",
+            volume->pool.hits, volume->pool.misses);
+    exfat_pool_release(volume);
+}
+
 // Debug print boot sector
 void exfat_debug_boot_sector(exfat_boot_sector_t* boot) {
     kprintf("\n=== exFAT Boot Sector ===\n");
@@ -360,14 +483,17 @@ uint32_t exfat_get_next_cluster(exfat_volume_t* volume, uint32_t cluster) {
     uint32_t fat_entry_offset = fat_offset % volume->bytes_per_sector;
 
     // Read FAT sector
-    uint8_t* sector = (uint8_t*)kmalloc(volume->bytes_per_sector);
-    if (disk_read_sector(fat_sector, sector) < 0) {
-        kfree(sector);
+    uint8_t* sector = exfat_get_sector_buffer(volume);
+    if (!sector) {
         return 0xFFFFFFFF;
     }
 
-    uint32_t next_cluster = *(uint32_t*)(sector + fat_entry_offset);
-    kfree(sector);
+    uint32_t next_cluster = 0xFFFFFFFF;
+    if (disk_read_sector(fat_sector, sector) == 0) {
+        next_cluster = *(uint32_t*)(sector + fat_entry_offset);
+    }
+
+    exfat_put_buffer(volume, sector);
 
     return next_cluster;
 }
@@ -376,10 +502,10 @@ uint32_t exfat_get_next_cluster(exfat_volume_t* volume, uint32_t cluster) {
 void exfat_list_root(exfat_volume_t* volume) {
     kprintf("\n=== Root Directory Listing ===\n");
 
-    uint8_t* cluster_buffer = (uint8_t*)kmalloc(volume->bytes_per_cluster);
-    if (exfat_read_cluster(volume, volume->root_dir_cluster, cluster_buffer) < 0) {
+    uint8_t* cluster_buffer = exfat_get_cluster_buffer(volume);
+    if (!cluster_buffer || exfat_read_cluster(volume, volume->root_dir_cluster, cluster_buffer) < 0) {
         kprintf("Failed to read root directory\n");
-        kfree(cluster_buffer);
+        exfat_put_buffer(volume, cluster_buffer);
         return;
     }
 
@@ -421,7 +547,7 @@ void exfat_list_root(exfat_volume_t* volume) {
     }
 
     kprintf("==============================\n\n");
-    kfree(cluster_buffer);
+    exfat_put_buffer(volume, cluster_buffer);
 }
 
 // Compare memory
@@ -60,7 +60,7 @@ static uint32_t exfat_alloc_cluster(exfat_volume_t* volume) {
     // In production, use bitmap for faster allocation
 
     uint32_t fat_entries = volume->boot_sector.cluster_count + 2;
-    uint8_t* fat_sector = (uint8_t*)kmalloc(volume->bytes_per_sector);
+    uint8_t* fat_sector = exfat_get_sector_buffer(volume);
 
     for (uint32_t cluster = 2; cluster < fat_entries; cluster++) {
         // Read FAT sector containing this cluster
@@ -69,7 +69,7 @@ static uint32_t exfat_alloc_cluster(exfat_volume_t* volume) {
         uint32_t offset_in_sector = fat_offset % volume->bytes_per_sector;
 
         if (disk_read_sector(sector, fat_sector) < 0) {
-            kfree(fat_sector);
+            exfat_put_buffer(volume, fat_sector);
             return 0;
         }
 
@@ -80,12 +80,12 @@ static uint32_t exfat_alloc_cluster(exfat_volume_t* volume) {
             // Mark as end of chain
             *(uint32_t*)(fat_sector + offset_in_sector) = 0xFFFFFFFF;
             disk_write_sector(sector, fat_sector);
-            kfree(fat_sector);
+            exfat_put_buffer(volume, fat_sector);
             return cluster;
         }
     }
 
-    kfree(fat_sector);
+    exfat_put_buffer(volume, fat_sector);
     kprintf("EXFAT: No free clusters available!\n");
     return 0;
 }
@@ -96,24 +96,24 @@ static int exfat_write_fat_entry(exfat_volume_t* volume, uint32_t cluster, uint3
     uint32_t sector = volume->fat_start_sector + (fat_offset / volume->bytes_per_sector);
     uint32_t offset_in_sector = fat_offset % volume->bytes_per_sector;
 
-    uint8_t* fat_sector = (uint8_t*)kmalloc(volume->bytes_per_sector);
+    uint8_t* fat_sector = exfat_get_sector_buffer(volume);
     if (disk_read_sector(sector, fat_sector) < 0) {
-        kfree(fat_sector);
+        exfat_put_buffer(volume, fat_sector);
         return -1;
     }
 
     *(uint32_t*)(fat_sector + offset_in_sector) = value;
 
     int result = disk_write_sector(sector, fat_sector);
-    kfree(fat_sector);
+    exfat_put_buffer(volume, fat_sector);
     return result;
 }
 
 // Helper: Find free directory entry slot in a cluster
 static int exfat_find_free_entry(exfat_volume_t* volume, uint32_t dir_cluster, uint32_t entries_needed, uint32_t* entry_index) {
-    uint8_t* cluster_data = (uint8_t*)kmalloc(volume->bytes_per_cluster);
+    uint8_t* cluster_data = exfat_get_cluster_buffer(volume);
     if (exfat_read_cluster(volume, dir_cluster, cluster_data) < 0) {
-        kfree(cluster_data);
+        exfat_put_buffer(volume, cluster_data);
         return -1;
     }
 
@@ -132,7 +132,7 @@ static int exfat_find_free_entry(exfat_volume_t* volume, uint32_t dir_cluster, u
 
         if (consecutive_free >= entries_needed) {
             *entry_index = start_index;
-            kfree(cluster_data);
+            exfat_put_buffer(volume, cluster_data);
             return 0;
         }
             } else {
@@ -140,7 +140,7 @@ static int exfat_find_free_entry(exfat_volume_t* volume, uint32_t dir_cluster, u
             }
     }
 
-    kfree(cluster_data);
+    exfat_put_buffer(volume, cluster_data);
     return -1;  // Not enough space
 }
 
@@ -180,9 +180,9 @@ int exfat_mkdir(exfat_volume_t* volume, const char* path) {
         }
 
         // Read directory cluster
-        uint8_t* cluster_data = (uint8_t*)kmalloc(volume->bytes_per_cluster);
+        uint8_t* cluster_data = exfat_get_cluster_buffer(volume);
         if (exfat_read_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
-            kfree(cluster_data);
+            exfat_put_buffer(volume, cluster_data);
             return -1;
         }
 
@@ -226,17 +226,17 @@ int exfat_mkdir(exfat_volume_t* volume, const char* path) {
 
         // Write back
         if (exfat_write_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
-            kfree(cluster_data);
+            exfat_put_buffer(volume, cluster_data);
             return -1;
         }
 
         // Initialize the new directory (empty)
-        uint8_t* empty_dir = (uint8_t*)kmalloc(volume->bytes_per_cluster);
+        uint8_t* empty_dir = exfat_get_cluster_buffer(volume);
         memset(empty_dir, 0, volume->bytes_per_cluster);
         exfat_write_cluster(volume, dir_cluster, empty_dir);
-        kfree(empty_dir);
+        exfat_put_buffer(volume, empty_dir);
 
-        kfree(cluster_data);
+        exfat_put_buffer(volume, cluster_data);
         kprintf("EXFAT: Directory '%s' created successfully!\n", dirname);
         return 0;
 }
@@ -300,9 +300,9 @@ int exfat_create(exfat_volume_t* volume, const char* path) {
         kprintf("EXFAT: Allocated cluster %d for file\n", file_cluster);
 
         // Read directory cluster
-        uint8_t* cluster_data = (uint8_t*)kmalloc(volume->bytes_per_cluster);
+        uint8_t* cluster_data = exfat_get_cluster_buffer(volume);
         if (exfat_read_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
-            kfree(cluster_data);
+            exfat_put_buffer(volume, cluster_data);
             return -1;
         }
 
@@ -351,11 +351,11 @@ int exfat_create(exfat_volume_t* volume, const char* path) {
 
         // Write directory cluster back
         if (exfat_write_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
-            kfree(cluster_data);
+            exfat_put_buffer(volume, cluster_data);
             return -1;
         }
 
-        kfree(cluster_data);
+        exfat_put_buffer(volume, cluster_data);
 
         kprintf("EXFAT: File '%s' created successfully!\n", filename);
         return 0;
@@ -372,9 +372,9 @@ int exfat_open(exfat_volume_t* volume, const char* path, exfat_file_t* file) {
     }
 
     // Read root directory
-    uint8_t* cluster_data = (uint8_t*)kmalloc(volume->bytes_per_cluster);
-    if (exfat_read_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
-        kfree(cluster_data);
+    uint8_t* cluster_data = exfat_get_cluster_buffer(volume);
+    if (!cluster_data || exfat_read_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
+        exfat_put_buffer(volume, cluster_data);
         return -1;
     }
 
@@ -424,7 +424,7 @@ int exfat_open(exfat_volume_t* volume, const char* path, exfat_file_t* file) {
                 }
                 file->name[stream_entry->name_length] = '\0';
 
-                kfree(cluster_data);
+                exfat_put_buffer(volume, cluster_data);
                 kprintf("EXFAT: File opened: '%s', size=%d bytes, cluster=%d\n",
                         file->name, (uint32_t)file->file_size, file->first_cluster);
                 return 0;
@@ -432,7 +432,7 @@ int exfat_open(exfat_volume_t* volume, const char* path, exfat_file_t* file) {
         }
     }
 
-    kfree(cluster_data);
+    exfat_put_buffer(volume, cluster_data);
     kprintf("EXFAT: File not found!\n");
     return -1;
 }
@@ -470,9 +470,9 @@ int exfat_read(exfat_volume_t* volume, exfat_file_t* file, void* buffer, uint32_
     }
 
     uint32_t offset_in_cluster = offset_in_file % volume->bytes_per_cluster;
-    uint8_t* cluster_buffer = (uint8_t*)kmalloc(volume->bytes_per_cluster);
+    uint8_t* cluster_buffer = exfat_get_cluster_buffer(volume);
 
-    while (bytes_read < size) {
+    while (cluster_buffer && bytes_read < size) {
         // Read cluster
         if (exfat_read_cluster(volume, current_cluster, cluster_buffer) < 0) {
             break;
@@ -498,7 +498,7 @@ int exfat_read(exfat_volume_t* volume, exfat_file_t* file, void* buffer, uint32_
         }
     }
 
-    kfree(cluster_buffer);
+    exfat_put_buffer(volume, cluster_buffer);
     kprintf("EXFAT: Read %d bytes\n", bytes_read);
     return bytes_read;
 }
@@ -506,9 +506,9 @@ int exfat_read(exfat_volume_t* volume, exfat_file_t* file, void* buffer, uint32_
 // Helper: Update file size in directory entry
 static int exfat_update_file_size(exfat_volume_t* volume, const char* filename, uint64_t new_size) {
     // Read root directory
-    uint8_t* cluster_data = (uint8_t*)kmalloc(volume->bytes_per_cluster);
-    if (exfat_read_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
-        kfree(cluster_data);
+    uint8_t* cluster_data = exfat_get_cluster_buffer(volume);
+    if (!cluster_data || exfat_read_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
+        exfat_put_buffer(volume, cluster_data);
         return -1;
     }
 
@@ -549,17 +549,17 @@ static int exfat_update_file_size(exfat_volume_t* volume, const char* filename,
 
                 // Write directory back
                 if (exfat_write_cluster(volume, volume->root_dir_cluster, cluster_data) < 0) {
-                    kfree(cluster_data);
+                    exfat_put_buffer(volume, cluster_data);
                     return -1;
                 }
 
-                kfree(cluster_data);
+                exfat_put_buffer(volume, cluster_data);
                 return 0;
             }
         }
     }
 
-    kfree(cluster_data);
+    exfat_put_buffer(volume, cluster_data);
     return -1;  // File not found
 }
 
@@ -593,9 +593,9 @@ int exfat_write(exfat_volume_t* volume, exfat_file_t* file, const void* buffer,
     }
 
     uint32_t offset_in_cluster = offset_in_file % volume->bytes_per_cluster;
-    uint8_t* cluster_buffer = (uint8_t*)kmalloc(volume->bytes_per_cluster);
+    uint8_t* cluster_buffer = exfat_get_cluster_buffer(volume);
 
-    while (bytes_written < size) {
+    while (cluster_buffer && bytes_written < size) {
         // Read existing cluster data (for partial writes)
         if (exfat_read_cluster(volume, current_cluster, cluster_buffer) < 0) {
             // If read fails, zero the buffer
@@ -633,7 +633,7 @@ int exfat_write(exfat_volume_t* volume, exfat_file_t* file, const void* buffer,
         }
     }
 
-    kfree(cluster_buffer);
+    exfat_put_buffer(volume, cluster_buffer);
 
     // Update file size if we extended it
     if (file->position > file->file_size) {
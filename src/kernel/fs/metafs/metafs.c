@@ -4,6 +4,7 @@
 #include "serial.h"
 #include "kstring.h"
 #include "heap.h"
+#include "kzone.h"
 
 // ===== SYSTEM VIEWS (like Windows System32) =====
 // These views are CRITICAL for OS function - delete them and the OS is dead
@@ -269,6 +270,10 @@ const char* metafs_type_to_string(object_type_t type) {
 }
 
 // ===== Initialization =====
+
+// Index memory across all mounted contexts
+#define METAFS_ZONE_QUOTA (1024 * 1024)
+
 int metafs_init(metafs_context_t* ctx, exfat_volume_t* volume) {
     if (!ctx || !volume) return -1;
 
@@ -280,8 +285,10 @@ int metafs_init(metafs_context_t* ctx, exfat_volume_t* volume) {
     ctx->num_views = 0;
     ctx->last_object_id = 0;
 
-    // Allocate index
-    ctx->index = (object_index_entry_t*)kmalloc(sizeof(object_index_entry_t) * ctx->max_objects);
+    // Allocate index, charged to the metafs zone so a runaway index
+    // cannot eat the memory page tables need
+    kzone_t* zone = kzone_create("metafs", METAFS_ZONE_QUOTA);
+    ctx->index = (object_index_entry_t*)kzone_alloc(zone, sizeof(object_index_entry_t) * ctx->max_objects);
     if (!ctx->index) {
         kprintf("METAFS: Failed to allocate index!\n");
         return -1;
@@ -5,6 +5,21 @@
 #include "serial.h"
 #include "kstring.h"
 #include "heap.h"
+#include "slab.h"
+
+// Listings are returned in fixed 128-entry arrays from a slab cache
+#define METAFS_VIEW_LIST_MAX 128
+
+static kmem_cache_t* view_list_cache = NULL;
+
+static metafs_view_entry_t* view_list_alloc(void) {
+    if (!view_list_cache) {
+        view_list_cache = kmem_cache_create("metafs_view_list",
+            sizeof(metafs_view_entry_t) * METAFS_VIEW_LIST_MAX, 0, NULL);
+    }
+    return (metafs_view_entry_t*)kmem_cache_alloc(view_list_cache);
+}
+
 // ===== Check if a MetaFS view exists =====
 int metafs_view_exists(metafs_context_t* ctx, const char* path) {
     if (!ctx || !path) return 0;
@@ -53,8 +68,13 @@ int metafs_view_list(metafs_context_t* ctx, const char* view_path,
     if (path[0] == '\0') {
         // Root - return list of views as entries
         int count = ctx->num_views;
-        metafs_view_entry_t* entries = (metafs_view_entry_t*)kmalloc(
-            sizeof(metafs_view_entry_t) * count);
+        if (count > METAFS_VIEW_LIST_MAX) {
+            kprintf("METAFS: %d views, listing only the first %d\n",
+                    count, METAFS_VIEW_LIST_MAX);
+            count = METAFS_VIEW_LIST_MAX;
+        }
+        metafs_view_entry_t* entries = view_list_alloc();
+        if (!entries) return -1;
         
         for (int i = 0; i < count; i++) {
             // Copy view name
@@ -107,9 +127,9 @@ int metafs_view_list(metafs_context_t* ctx, const char* view_path,
     // Scan MetaFS index AND match with view links on disk
     // For each object in the index, check if it has a link in this view
     
-    int max_entries = 128;
-    metafs_view_entry_t* entries = (metafs_view_entry_t*)kmalloc(
-        sizeof(metafs_view_entry_t) * max_entries);
+    int max_entries = METAFS_VIEW_LIST_MAX;
+    metafs_view_entry_t* entries = view_list_alloc();
+    if (!entries) return -1;
     int count = 0;
     
     kprintf("METAFS: Scanning %d objects in index...\n", ctx->num_objects);
@@ -380,6 +400,6 @@ int shell_path_is_valid(const char* current_dir, const char* path) {
 // ===== Free entries list =====
 void metafs_view_list_free(metafs_view_entry_t* entries) {
     if (entries) {
-        kfree(entries);
+        kmem_cache_free(view_list_cache, entries);
     }
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+// src/kernel/memory/arena.c - Scoped bump allocator for short-lived scratch memory
+#include "arena.h"
+#include "physical_mm.h"
+#include "paging.h"
+#include "serial.h"
+
+#define ARENA_POOL_MAX 8    // Standard chunks kept for reuse
+
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(arena_chunk_t), ARENA_ALIGN)
+#define ARENA_HEADER_SIZE (CHUNK_HEADER_SIZE + ALIGN_UP(sizeof(arena_t), ARENA_ALIGN))
+
+static arena_chunk_t* chunk_pool = NULL;
+static arena_stats_t stats = {0};
+
+// Standard chunks come from the pool when possible; oversized ones are
+// allocated to fit and always go straight back to the PMM.
+static arena_chunk_t* chunk_get(uint64_t bytes) {
+    arena_chunk_t* chunk;
+
+    if (bytes == ARENA_CHUNK_SIZE && chunk_pool) {
+        chunk = chunk_pool;
+        chunk_pool = chunk->next;
+        stats.chunks_pooled--;
+        stats.chunk_reuses++;
+    } else {
+        // Physical pages are reached through the physmap
+        void* pages = alloc_pages((uint32_t)(bytes / PAGE_SIZE));
+        if (!pages) {
+            kprintf("ARENA: Out of pages for %d KB chunk\n", (uint32_t)(bytes / 1024));
+            return NULL;
+        }
+        chunk = (arena_chunk_t*)phys_to_virt((uint64_t)(uintptr_t)pages);
+        stats.chunk_allocs++;
+    }
+
+    chunk->next = NULL;
+    chunk->size = bytes;
+    chunk->used = CHUNK_HEADER_SIZE;
+    return chunk;
+}
+
+static void chunk_put(arena_chunk_t* chunk) {
+    if (chunk->size == ARENA_CHUNK_SIZE && stats.chunks_pooled < ARENA_POOL_MAX) {
+        chunk->next = chunk_pool;
+        chunk_pool = chunk;
+        stats.chunks_pooled++;
+        return;
+    }
+
+    uint64_t pages = virt_to_phys(chunk);
+    for (uint64_t offset = 0; offset < chunk->size; offset += PAGE_SIZE) {
+        free_page((void*)(uintptr_t)(pages + offset));
+    }
+}
+
+arena_t* arena_create(void) {
+    arena_chunk_t* chunk = chunk_get(ARENA_CHUNK_SIZE);
+    if (!chunk) return NULL;
+
+    arena_t* arena = (arena_t*)((uint8_t*)chunk + CHUNK_HEADER_SIZE);
+    arena->chunks = chunk;
+    arena->allocated = 0;
+    chunk->used = ARENA_HEADER_SIZE;
+
+    stats.arenas_created++;
+    return arena;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    if (!arena || size == 0) return NULL;
+
+    uint64_t bytes = ALIGN_UP((uint64_t)size, ARENA_ALIGN);
+    arena_chunk_t* current = arena->chunks;
+
+    if (current->used + bytes > current->size) {
+        uint64_t needed = CHUNK_HEADER_SIZE + bytes;
+
+        if (needed > ARENA_CHUNK_SIZE) {
+            // Oversized: dedicated chunk behind the current one, which
+            // keeps serving small requests
+            arena_chunk_t* chunk = chunk_get(ALIGN_UP(needed, PAGE_SIZE));
+            if (!chunk) return NULL;
+
+            chunk->used = needed;
+            chunk->next = current->next;
+            current->next = chunk;
+            arena->allocated += bytes;
+            return (uint8_t*)chunk + CHUNK_HEADER_SIZE;
+        }
+
+        arena_chunk_t* chunk = chunk_get(ARENA_CHUNK_SIZE);
+        if (!chunk) return NULL;
+
+        chunk->next = current;
+        arena->chunks = chunk;
+        current = chunk;
+    }
+
+    void* ptr = (uint8_t*)current + current->used;
+    current->used += bytes;
+    arena->allocated += bytes;
+    return ptr;
+}
+
+void arena_reset(arena_t* arena) {
+    if (!arena) return;
+
+    // Keep only the chunk that holds the arena header
+    arena_chunk_t* home = (arena_chunk_t*)((uint8_t*)arena - CHUNK_HEADER_SIZE);
+    arena_chunk_t* chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        if (chunk != home) {
+            chunk_put(chunk);
+        }
+        chunk = next;
+    }
+
+    home->next = NULL;
+    home->used = ARENA_HEADER_SIZE;
+    arena->chunks = home;
+    arena->allocated = 0;
+}
+
+void arena_destroy(arena_t* arena) {
+    if (!arena) return;
+
+    arena_reset(arena);
+    chunk_put(arena->chunks);
+}
+
+void arena_get_stats(arena_stats_t* out) {
+    if (!out) return;
+    *out = stats;
+}
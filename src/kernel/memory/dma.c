@@ -1,122 +1,235 @@
 // src/kernel/memory/dma.c - DMA buffer management for low memory
 #include "dma.h"
-#include "physical_mm.h"
+#include "memory.h"
 #include "kstring.h"
 #include "serial.h"
-#include "heap.h"
 
 // DMA region: 0x10000 - 0x9FFFF (below 1MB for ISA compatibility)
 #define DMA_START 0x00010000
 #define DMA_END   0x000A0000
 #define DMA_SIZE  (DMA_END - DMA_START)
+#define DMA_PAGES (DMA_SIZE / DMA_PAGE_SIZE)
+#define DMA_WORDS ((DMA_PAGES + 63) / 64)
 
-typedef struct dma_block {
-    uint32_t address;
-    uint32_t size;
-    int in_use;
-    struct dma_block* next;
-} dma_block_t;
+// One bit per page, set when allocated or not usable RAM. All metadata is
+// static: free space is simply the clear bits, so neighbouring frees
+// coalesce without any list surgery.
+static uint64_t dma_bitmap[DMA_WORDS];
+
+// Length in pages of the allocation starting at each page (0 elsewhere),
+// which makes dma_free() a lookup plus a masked clear
+static uint8_t dma_run[DMA_PAGES];
 
-static dma_block_t* dma_free_list = NULL;
 static uint32_t dma_total_size = 0;
 static uint32_t dma_used_size = 0;
 
+static inline uint32_t page_of(uint64_t addr) {
+    return (uint32_t)((addr - DMA_START) / DMA_PAGE_SIZE);
+}
+
+static inline uint64_t page_addr(uint32_t page) {
+    return DMA_START + (uint64_t)page * DMA_PAGE_SIZE;
+}
+
+static void bitmap_set_range(uint32_t start, uint32_t count, int used) {
+    while (count) {
+        uint32_t bit = start % 64;
+        uint32_t span = 64 - bit;
+        if (span > count) span = count;
+
+        uint64_t mask = (span == 64) ? ~0ULL : (((1ULL << span) - 1) << bit);
+        if (used) {
+            dma_bitmap[start / 64] |= mask;
+        } else {
+            dma_bitmap[start / 64] &= ~mask;
+        }
+        start += span;
+        count -= span;
+    }
+}
+
+// First page at or after `from` whose bit equals `used`; DMA_PAGES if none
+static uint32_t bitmap_find(uint32_t from, int used) {
+    while (from < DMA_PAGES) {
+        uint64_t word = dma_bitmap[from / 64];
+        if (!used) word = ~word;
+        word &= ~0ULL << (from % 64);
+
+        if (word) {
+            uint32_t page = (from & ~63u) + __builtin_ctzll(word);
+            return page < DMA_PAGES ? page : DMA_PAGES;
+        }
+        from = (from & ~63u) + 64;
+    }
+    return DMA_PAGES;
+}
+
+static void* run_alloc(uint32_t start, uint32_t pages) {
+    bitmap_set_range(start, pages, 1);
+    dma_run[start] = (uint8_t)pages;
+    dma_used_size += pages * DMA_PAGE_SIZE;
+    return (void*)(uintptr_t)page_addr(start);
+}
+
+// A page is usable if the E820 map reports it as RAM. Without a map the
+// whole conventional-memory window is trusted.
+static int page_is_ram(uint32_t page) {
+    uint32_t count;
+    const e820_entry_t* map = memory_get_e820(&count);
+    if (count == 0) return 1;
+
+    uint64_t start = page_addr(page);
+    for (uint32_t i = 0; i < count; i++) {
+        if (map[i].type == E820_TYPE_USABLE && map[i].base <= start &&
+            map[i].base + map[i].length >= start + DMA_PAGE_SIZE) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void dma_init(void) {
     kprintf("DMA: Initializing buffer pool...\n");
-    
-    // Create initial free block covering entire DMA region
-    dma_free_list = (dma_block_t*)kmalloc(sizeof(dma_block_t));
-    if (!dma_free_list) {
-        kprintf("DMA: Failed to allocate management structure!\n");
-        return;
+
+    memset(dma_bitmap, 0, sizeof(dma_bitmap));
+    memset(dma_run, 0, sizeof(dma_run));
+
+    // Pages the firmware keeps (EBDA and the like) stay allocated forever
+    uint32_t usable = 0;
+    for (uint32_t page = 0; page < DMA_PAGES; page++) {
+        if (page_is_ram(page)) {
+            usable++;
+        } else {
+            bitmap_set_range(page, 1, 1);
+        }
     }
-    
-    dma_free_list->address = DMA_START;
-    dma_free_list->size = DMA_SIZE;
-    dma_free_list->in_use = 0;
-    dma_free_list->next = NULL;
-    
-    dma_total_size = DMA_SIZE;
+
+    dma_total_size = usable * DMA_PAGE_SIZE;
     dma_used_size = 0;
-    
-    kprintf("DMA: Initialized %d KB buffer pool at 0x%x - 0x%x\n", 
-            DMA_SIZE / 1024, DMA_START, DMA_END - 1);
-    kprintf("DMA: Available for disk I/O, networking, audio, USB\n");
+
+    kprintf("DMA: Initialized %d KB buffer pool at 0x%x - 0x%x (%d pages)\n",
+            dma_total_size / 1024, DMA_START, DMA_END - 1, usable);
+}
+
+// First free run of at least `pages`; DMA_PAGES if there is none
+static uint32_t find_fit(uint32_t pages) {
+    for (uint32_t start = bitmap_find(0, 0); start < DMA_PAGES; ) {
+        uint32_t end = bitmap_find(start, 1);
+        if (end - start >= pages) return start;
+        start = bitmap_find(end, 0);
+    }
+    return DMA_PAGES;
+}
+
+// Longest free run; returns its length in pages and its start in *start
+static uint32_t largest_run(uint32_t* start) {
+    uint32_t best = 0;
+    for (uint32_t page = bitmap_find(0, 0); page < DMA_PAGES; ) {
+        uint32_t end = bitmap_find(page, 1);
+        if (end - page > best) {
+            best = end - page;
+            *start = page;
+        }
+        page = bitmap_find(end, 0);
+    }
+    return best;
 }
 
 void* dma_alloc(uint32_t size) {
-    if (size == 0) return NULL;
-    
+    if (size == 0 || size > DMA_SIZE) return NULL;
+
     // Align to 4KB boundaries (common DMA requirement)
-    size = (size + 0xFFF) & ~0xFFF;
-    
-    dma_block_t* current = dma_free_list;
-    while (current) {
-        if (!current->in_use && current->size >= size) {
-            // Split block if larger than needed
-            if (current->size > size + sizeof(dma_block_t) + 0x1000) {
-                dma_block_t* new_block = (dma_block_t*)kmalloc(sizeof(dma_block_t));
-                if (new_block) {
-                    new_block->address = current->address + size;
-                    new_block->size = current->size - size;
-                    new_block->in_use = 0;
-                    new_block->next = current->next;
-                    current->next = new_block;
-                    current->size = size;
-                }
-            }
-            
-            current->in_use = 1;
-            dma_used_size += size;
-            
-            kprintf("DMA: Allocated %d KB at 0x%x\n", size / 1024, current->address);
-            return (void*)current->address;
-        }
-        current = current->next;
+    uint32_t pages = (size + DMA_PAGE_SIZE - 1) / DMA_PAGE_SIZE;
+
+    uint32_t start = find_fit(pages);
+    if (start < DMA_PAGES) {
+        return run_alloc(start, pages);
     }
-    
-    kprintf("DMA: Out of memory (requested %d KB, %d KB available)\n", 
-            size / 1024, (dma_total_size - dma_used_size) / 1024);
+
+    kprintf("DMA: Out of memory (requested %d KB, %d KB available)\n",
+            pages * 4, (dma_total_size - dma_used_size) / 1024);
     return NULL;
 }
 
 void dma_free(void* ptr) {
     if (!ptr) return;
-    
-    uint32_t addr = (uint32_t)ptr;
-    
+
+    uint64_t addr = (uint64_t)(uintptr_t)ptr;
+
     // Validate address is in DMA range
-    if (addr < DMA_START || addr >= DMA_END) {
-        kprintf("DMA: Invalid free at 0x%x (outside DMA region)\n", addr);
+    if (addr < DMA_START || addr >= DMA_END || (addr & (DMA_PAGE_SIZE - 1))) {
+        kprintf("DMA: Invalid free at 0x%x (outside DMA region)\n", (uint32_t)addr);
         return;
     }
-    
-    dma_block_t* current = dma_free_list;
-    while (current) {
-        if (current->address == addr && current->in_use) {
-            current->in_use = 0;
-            dma_used_size -= current->size;
-            
-            kprintf("DMA: Freed %d KB at 0x%x\n", current->size / 1024, addr);
-            
-            // Coalesce with next block if free
-            if (current->next && !current->next->in_use) {
-                dma_block_t* next = current->next;
-                current->size += next->size;
-                current->next = next->next;
-                kfree(next);
-            }
-            
-            return;
+
+    uint32_t page = page_of(addr);
+    uint32_t pages = dma_run[page];
+    if (pages == 0) {
+        kprintf("DMA: Invalid free at 0x%x (not allocated)\n", (uint32_t)addr);
+        return;
+    }
+
+    dma_run[page] = 0;
+    bitmap_set_range(page, pages, 0);
+    dma_used_size -= pages * DMA_PAGE_SIZE;
+}
+
+int dma_sg_alloc(dma_sg_list_t* sg, uint32_t size, uint32_t max_segment) {
+    if (!sg) return -1;
+
+    sg->count = 0;
+    sg->total = 0;
+    if (size == 0) return -1;
+
+    uint32_t remaining = (size + DMA_PAGE_SIZE - 1) / DMA_PAGE_SIZE;
+    uint32_t max_pages = max_segment / DMA_PAGE_SIZE;
+    if (max_pages == 0 || max_pages > DMA_PAGES) max_pages = DMA_PAGES;
+
+    while (remaining) {
+        if (sg->count == DMA_SG_MAX) break;
+
+        // A run that holds the whole (capped) piece if there is one,
+        // otherwise the longest run left
+        uint32_t want = remaining < max_pages ? remaining : max_pages;
+        uint32_t take = want;
+        uint32_t start = find_fit(want);
+        if (start == DMA_PAGES) {
+            take = largest_run(&start);
+            if (take == 0) break;
         }
-        current = current->next;
+
+        run_alloc(start, take);
+        sg->segments[sg->count].phys = page_addr(start);
+        sg->segments[sg->count].length = take * DMA_PAGE_SIZE;
+        sg->count++;
+        sg->total += take * DMA_PAGE_SIZE;
+        remaining -= take;
+    }
+
+    if (remaining) {
+        dma_sg_free(sg);
+        return -1;
     }
-    
-    kprintf("DMA: Invalid free at 0x%x (not allocated)\n", addr);
+    return 0;
+}
+
+void dma_sg_free(dma_sg_list_t* sg) {
+    if (!sg) return;
+
+    for (uint32_t i = 0; i < sg->count; i++) {
+        dma_free((void*)(uintptr_t)sg->segments[i].phys);
+    }
+    sg->count = 0;
+    sg->total = 0;
 }
 
 void dma_get_stats(uint32_t* total, uint32_t* used, uint32_t* free) {
     if (total) *total = dma_total_size;
     if (used) *used = dma_used_size;
     if (free) *free = dma_total_size - dma_used_size;
-}
\ No newline at end of file
+}
+
+uint32_t dma_get_largest_free(void) {
+    uint32_t start;
+    return largest_run(&start) * DMA_PAGE_SIZE;
+}
@@ -4,14 +4,408 @@
 #include "paging.h"
 #include "kstring.h"
 #include "serial.h"
+#include "slab.h"
 
 #define HEAP_MAGIC 0xDEADBEEF
-#define MIN_BLOCK_SIZE 32
 
+// Flags kept in the low bits of heap_block_t.size
+#define BLOCK_FREE       0x1
+#define BLOCK_PREV_FREE  0x2
+#define BLOCK_FLAGS      (BLOCK_FREE | BLOCK_PREV_FREE)
+
+// Used blocks only carry prev_phys and size; the list links live in the payload
+#define HEAP_BLOCK_OVERHEAD  offsetof(heap_block_t, next_free)
+#define MIN_BLOCK_SIZE       (sizeof(heap_block_t) - HEAP_BLOCK_OVERHEAD)
+#define HEAP_MAX_ALLOC       ((1ULL << HEAP_FL_INDEX_MAX) - HEAP_SMALL_BLOCK_SIZE)
+
+// Each contiguous region handed to the heap starts with a pool header and
+// ends with a zero-sized used sentinel block so coalescing stops there.
+typedef struct heap_pool {
+    struct heap_pool* next;
+    uint64_t size;
+} heap_pool_t;
+
+static heap_pool_t* heap_pools = NULL;
 static heap_block_t* heap_start = NULL;
-static uint32_t heap_size = 0;
+static uint64_t heap_size = 0;
 static int paging_enabled = 0;
 
+// Segregated free lists: first level by power of two, second level linear
+static uint64_t fl_bitmap = 0;
+static uint32_t sl_bitmap[HEAP_FL_INDEX_COUNT];
+static heap_block_t* free_lists[HEAP_FL_INDEX_COUNT][HEAP_SL_INDEX_COUNT];
+
+// Large allocations live outside the heap, tracked in a small hash table
+#define HEAP_LARGE_BUCKETS 64
+
+typedef struct heap_large {
+    uintptr_t address;
+    uint64_t size;                  // Page-granular size in bytes
+    uint32_t is_virtual;            // From kmalloc_virtual() vs alloc_pages()
+    uint32_t site;                  // Profiling site
+    uint64_t requested;
+    struct heap_large* next;
+} heap_large_t;
+
+static heap_large_t* large_table[HEAP_LARGE_BUCKETS];
+static kmem_cache_t* large_cache = NULL;
+static uint64_t stat_large_size = 0;
+static uint32_t stat_num_large = 0;
+
+// Running totals so statistics never need a heap walk
+static uint64_t stat_used_size = 0;
+static uint64_t stat_free_size = 0;
+static uint32_t stat_num_blocks = 0;
+static uint32_t stat_num_free_blocks = 0;
+
+static inline uint32_t fls64(uint64_t value) {
+    return 63 - __builtin_clzll(value);
+}
+
+// Profiling: slot 0 collects sites that do not fit in the table
+#define SITE_OVERFLOW 0
+
+static heap_site_t sites[HEAP_MAX_SITES] = { [SITE_OVERFLOW] = { .tag = "(other)" } };
+static uint32_t stat_num_sites = 1;
+static uint64_t stat_peak_used = 0;
+static uint32_t stat_histogram[HEAP_HIST_BUCKETS];
+
+#define CALLER_SITE() site_lookup(NULL, (uintptr_t)__builtin_return_address(0))
+
+// Find or claim the profiling slot for a tag (or return address)
+static uint32_t site_lookup(const char* tag, uintptr_t caller) {
+    if (tag) caller = 0;
+
+    uint64_t key = tag ? (uintptr_t)tag : caller;
+    uint32_t hash = (uint32_t)((key >> 2) * 2654435761u);
+
+    for (uint32_t probe = 0; probe < HEAP_MAX_SITES - 1; probe++) {
+        uint32_t index = 1 + (hash + probe) % (HEAP_MAX_SITES - 1);
+        heap_site_t* site = &sites[index];
+
+        if (site->tag == tag && site->caller == caller && site->total_allocs) {
+            return index;
+        }
+        if (!site->total_allocs) {
+            site->tag = tag;
+            site->caller = caller;
+            return index;
+        }
+    }
+
+    return SITE_OVERFLOW;
+}
+
+static inline uint32_t histogram_bucket(uint64_t size) {
+    if (size <= 16) return 0;
+    uint32_t bucket = fls64(size - 1) - 3;
+    return bucket < HEAP_HIST_BUCKETS ? bucket : HEAP_HIST_BUCKETS - 1;
+}
+
+static void site_charge(uint32_t index, uint64_t requested) {
+    heap_site_t* site = &sites[index];
+
+    // A claimed slot only becomes a site with its first allocation; a
+    // failed one leaves it free for the next lookup
+    if (!site->total_allocs && index != SITE_OVERFLOW) {
+        stat_num_sites++;
+    }
+    site->live_bytes += requested;
+    site->live_allocs++;
+    site->total_allocs++;
+    stat_histogram[histogram_bucket(requested)]++;
+
+    uint64_t used = stat_used_size + stat_large_size;
+    if (used > stat_peak_used) {
+        stat_peak_used = used;
+    }
+}
+
+static void site_uncharge(uint32_t index, uint64_t requested) {
+    heap_site_t* site = &sites[index];
+    site->live_bytes -= requested;
+    site->live_allocs--;
+}
+
+static inline uint64_t block_size(heap_block_t* block) {
+    return block->size & ~(uint64_t)BLOCK_FLAGS;
+}
+
+static inline void* block_to_ptr(heap_block_t* block) {
+    return (uint8_t*)block + HEAP_BLOCK_OVERHEAD;
+}
+
+static inline heap_block_t* ptr_to_block(void* ptr) {
+    return (heap_block_t*)((uint8_t*)ptr - HEAP_BLOCK_OVERHEAD);
+}
+
+static inline heap_block_t* block_next(heap_block_t* block) {
+    return (heap_block_t*)((uint8_t*)block_to_ptr(block) + block_size(block));
+}
+
+// Free block: flag it and leave a boundary tag in the next block
+static void block_mark_free(heap_block_t* block) {
+    heap_block_t* next = block_next(block);
+    block->size |= BLOCK_FREE;
+    next->prev_phys = block;
+    next->size |= BLOCK_PREV_FREE;
+}
+
+static void block_mark_used(heap_block_t* block) {
+    heap_block_t* next = block_next(block);
+    block->size &= ~(uint64_t)BLOCK_FREE;
+    next->size &= ~(uint64_t)BLOCK_PREV_FREE;
+}
+
+// Map a block size to its (first level, second level) list
+static void mapping_insert(uint64_t size, uint32_t* fl, uint32_t* sl) {
+    if (size < HEAP_SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = (uint32_t)(size / (HEAP_SMALL_BLOCK_SIZE / HEAP_SL_INDEX_COUNT));
+    } else {
+        uint32_t f = fls64(size);
+        *sl = (uint32_t)(size >> (f - HEAP_SL_INDEX_COUNT_LOG2)) ^ HEAP_SL_INDEX_COUNT;
+        *fl = f - (HEAP_FL_INDEX_SHIFT - 1);
+    }
+}
+
+// Like mapping_insert, but rounds up so every block in the list fits
+static void mapping_search(uint64_t size, uint32_t* fl, uint32_t* sl) {
+    if (size >= HEAP_SMALL_BLOCK_SIZE) {
+        size += (1ULL << (fls64(size) - HEAP_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static void insert_free_block(heap_block_t* block) {
+    uint32_t fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    heap_block_t* head = free_lists[fl][sl];
+    block->prev_free = NULL;
+    block->next_free = head;
+    if (head) {
+        head->prev_free = block;
+    }
+    free_lists[fl][sl] = block;
+
+    fl_bitmap |= 1ULL << fl;
+    sl_bitmap[fl] |= 1u << sl;
+
+    stat_free_size += block_size(block);
+    stat_num_free_blocks++;
+}
+
+static void remove_free_block(heap_block_t* block) {
+    uint32_t fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        free_lists[fl][sl] = block->next_free;
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+
+    if (!free_lists[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl]) {
+            fl_bitmap &= ~(1ULL << fl);
+        }
+    }
+
+    stat_free_size -= block_size(block);
+    stat_num_free_blocks--;
+}
+
+// Two bitmap scans find the first non-empty list that is large enough
+static heap_block_t* locate_free_block(uint64_t size) {
+    uint32_t fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= HEAP_FL_INDEX_COUNT) return NULL;
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        uint64_t fl_map = fl_bitmap & (~0ULL << (fl + 1));
+        if (fl + 1 >= 64 || !fl_map) return NULL;
+
+        fl = __builtin_ctzll(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+
+    sl = __builtin_ctz(sl_map);
+    return free_lists[fl][sl];
+}
+
+// Cut `block` to `size` bytes and return the remainder as a new block
+static heap_block_t* block_split(heap_block_t* block, uint64_t size) {
+    heap_block_t* rest = (heap_block_t*)((uint8_t*)block_to_ptr(block) + size);
+    rest->size = block_size(block) - size - HEAP_BLOCK_OVERHEAD;
+    block->size = size | (block->size & BLOCK_FLAGS);
+    stat_num_blocks++;
+    return rest;
+}
+
+static inline int block_can_split(heap_block_t* block, uint64_t size) {
+    return block_size(block) >= size + sizeof(heap_block_t);
+}
+
+// Return a block to the free lists, merging with both physical neighbours
+static void block_release(heap_block_t* block) {
+    if (block->size & BLOCK_PREV_FREE) {
+        heap_block_t* prev = block->prev_phys;
+        remove_free_block(prev);
+        prev->size += HEAP_BLOCK_OVERHEAD + block_size(block);
+        stat_num_blocks--;
+        block = prev;
+    }
+
+    heap_block_t* next = block_next(block);
+    if (next->size & BLOCK_FREE) {
+        remove_free_block(next);
+        block->size += HEAP_BLOCK_OVERHEAD + block_size(next);
+        stat_num_blocks--;
+    }
+
+    block_mark_free(block);
+    insert_free_block(block);
+}
+
+// Trim a block just taken off a free list, returning the tail to the lists
+static void block_trim_free(heap_block_t* block, uint64_t size) {
+    if (block_can_split(block, size)) {
+        heap_block_t* rest = block_split(block, size);
+        block_mark_free(rest);
+        insert_free_block(rest);
+    }
+}
+
+// Trim a used block in place, releasing the tail
+static void block_trim_used(heap_block_t* block, uint64_t size) {
+    if (block_can_split(block, size)) {
+        uint64_t old_size = block_size(block);
+        heap_block_t* rest = block_split(block, size);
+        stat_used_size -= old_size - size;
+        block_release(rest);
+    }
+}
+
+static uint64_t adjust_request_size(size_t size) {
+    if (size == 0 || size > HEAP_MAX_ALLOC) return 0;
+
+    uint64_t adjusted = ALIGN_UP((uint64_t)size, HEAP_ALIGN_SIZE);
+    return adjusted < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : adjusted;
+}
+
+// Hand a contiguous region to the allocator as one free block
+static void heap_add_pool(void* memory, uint64_t bytes) {
+    heap_pool_t* pool = (heap_pool_t*)memory;
+    pool->size = bytes;
+    pool->next = heap_pools;
+    heap_pools = pool;
+
+    heap_block_t* block = (heap_block_t*)((uint8_t*)memory + sizeof(heap_pool_t));
+    block->prev_phys = NULL;
+    block->size = bytes - sizeof(heap_pool_t) - 2 * HEAP_BLOCK_OVERHEAD;
+
+    heap_block_t* sentinel = block_next(block);
+    sentinel->size = 0;
+
+    stat_num_blocks++;
+    block_mark_free(block);
+    insert_free_block(block);
+
+    if (!heap_start) {
+        heap_start = block;
+    }
+    heap_size += bytes;
+}
+
+static inline uint32_t large_bucket(uintptr_t address) {
+    return (uint32_t)(address >> 12) & (HEAP_LARGE_BUCKETS - 1);
+}
+
+static heap_large_t* large_find(void* ptr) {
+    for (heap_large_t* large = large_table[large_bucket((uintptr_t)ptr)]; large; large = large->next) {
+        if (large->address == (uintptr_t)ptr) {
+            return large;
+        }
+    }
+    return NULL;
+}
+
+// Serve a large request with whole pages so it never fragments the heap
+static void* large_alloc(size_t size, uint32_t site) {
+    uint64_t bytes = ALIGN_UP((uint64_t)size, PAGE_SIZE);
+
+    if (!large_cache) {
+        large_cache = kmem_cache_create("heap_large", sizeof(heap_large_t), 0, NULL);
+    }
+    heap_large_t* large = (heap_large_t*)kmem_cache_alloc(large_cache);
+    if (!large) return NULL;
+
+    void* memory;
+    if (paging_enabled) {
+        memory = kmalloc_virtual(bytes);
+    } else {
+        memory = alloc_pages((uint32_t)(bytes / PAGE_SIZE));
+        if (memory) {
+            page_set_owner((uint64_t)(uintptr_t)memory, (uint32_t)(bytes / PAGE_SIZE),
+                           PAGE_OWNER_HEAP);
+            memory = phys_to_virt((uint64_t)(uintptr_t)memory);
+        }
+    }
+    if (!memory) {
+        kprintf("HEAP: Large allocation of %d KB failed\n", (uint32_t)(bytes / 1024));
+        kmem_cache_free(large_cache, large);
+        return NULL;
+    }
+
+    large->address = (uintptr_t)memory;
+    large->size = bytes;
+    large->is_virtual = paging_enabled;
+    large->site = site;
+    large->requested = size;
+
+    uint32_t bucket = large_bucket(large->address);
+    large->next = large_table[bucket];
+    large_table[bucket] = large;
+
+    stat_large_size += bytes;
+    stat_num_large++;
+    site_charge(site, size);
+    return memory;
+}
+
+// Returns 1 if ptr was a large allocation (and is now freed)
+static int large_free(void* ptr) {
+    heap_large_t** current = &large_table[large_bucket((uintptr_t)ptr)];
+    while (*current && (*current)->address != (uintptr_t)ptr) {
+        current = &(*current)->next;
+    }
+
+    heap_large_t* large = *current;
+    if (!large) return 0;
+    *current = large->next;
+
+    if (large->is_virtual) {
+        kfree_virtual(ptr, large->size);
+    } else {
+        uint64_t pages = virt_to_phys(ptr);
+        for (uint64_t offset = 0; offset < large->size; offset += PAGE_SIZE) {
+            put_page(pages + offset);
+        }
+    }
+
+    stat_large_size -= large->size;
+    stat_num_large--;
+    site_uncharge(large->site, large->requested);
+    kmem_cache_free(large_cache, large);
+    return 1;
+}
+
 // Initialize heap - works before or after paging
 void heap_init(void) {
     // Allocate initial heap space (16MB for large allocations like exFAT disk)
@@ -25,19 +419,25 @@ void heap_init(void) {
         return;
     }
 
-    // Use physical address directly (works before paging)
-    heap_start = (heap_block_t*)physical_base;
+    // The pool keeps its identity address after paging_init(), which maps
+    // only BOOT_IDENTITY_SIZE of it; anything above would fault later
+    uint64_t pool_end = (uint64_t)(uintptr_t)physical_base + initial_size;
+    if (pool_end > BOOT_IDENTITY_SIZE) {
+        kprintf("HEAP: Initial pool %llx - %llx is past the %u MB boot identity map\n",
+                (uint64_t)(uintptr_t)physical_base, pool_end - 1,
+                (uint32_t)(BOOT_IDENTITY_SIZE / (1024 * 1024)));
+        for (;;) {
+            __asm__ volatile("cli; hlt");
+        }
+    }
 
-    // Initialize first block
-    heap_start->size = initial_size - sizeof(heap_block_t);
-    heap_start->is_free = 1;
-    heap_start->next = NULL;
-    heap_start->prev = NULL;
+    page_set_owner((uint64_t)(uintptr_t)physical_base, pages_needed, PAGE_OWNER_HEAP);
 
-    heap_size = initial_size;
+    // Use physical address directly (works before paging)
     paging_enabled = 0;
+    heap_add_pool(phys_to_virt((uint64_t)(uintptr_t)physical_base), initial_size);
 
-    kprintf("HEAP: Initialized at %x with %d MB (physical mode)\n",
+    kprintf("HEAP: Initialized at %x with %d MB (physical mode, TLSF)\n",
             heap_start, initial_size / 1024 / 1024);
 }
 
@@ -48,194 +448,181 @@ void heap_init_virtual(void) {
         return;
     }
 
-    // The heap is already accessible via identity mapping (first 4MB)
-    // We just need to mark that we're now in paging mode
-    // The heap will continue to work at its current physical address
-    // which is identity-mapped in the page tables
+    // The initial pool stays reachable through the boot identity map
+    // (first 32MB; heap_init() checked it fits). Later pools come from the
+    // physmap, and large blocks from kmalloc_virtual().
 
     paging_enabled = 1;
 
     kprintf("HEAP: Paging mode enabled\n");
     kprintf("  Heap remains at physical address %x (identity-mapped)\n", heap_start);
-    kprintf("  Future expansions will use virtual memory\n");
+    kprintf("  Future expansions will use the physmap\n");
 }
 
-// Expand heap if needed
-static int expand_heap(size_t additional_size) {
-    uint32_t pages_needed = (additional_size + PAGE_SIZE - 1) / PAGE_SIZE;
-
-    if (paging_enabled) {
-        // With paging enabled, allocate using virtual memory
-        void* new_mem = kmalloc_virtual(pages_needed * PAGE_SIZE);
-        if (!new_mem) {
-            kprintf("HEAP: Failed to expand (virtual)\n");
-            return -1;
-        }
-
-        // Create new block
-        heap_block_t* new_block = (heap_block_t*)new_mem;
-        new_block->size = (pages_needed * PAGE_SIZE) - sizeof(heap_block_t);
-        new_block->is_free = 1;
-        new_block->next = NULL;
-        new_block->prev = NULL;
-
-        // Link to existing heap
-        heap_block_t* current = heap_start;
-        while (current->next) {
-            current = current->next;
-        }
-        current->next = new_block;
-        new_block->prev = current;
+// Expand heap if needed. The new pool is sized so that its free block
+// lands in a list at least as large as the one kmalloc() searches.
+static int expand_heap(uint64_t request_size) {
+    uint64_t bytes = request_size + (request_size >> HEAP_SL_INDEX_COUNT_LOG2)
+                   + sizeof(heap_pool_t) + 2 * HEAP_BLOCK_OVERHEAD;
+    uint32_t pages_needed = (uint32_t)((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    // Contiguous pages through the physmap (identity before paging), so
+    // pools need no per-page mappings
+    void* physical = alloc_pages(pages_needed);
+    if (!physical) {
+        kprintf("HEAP: Failed to expand\n");
+        return -1;
+    }
+    page_set_owner((uint64_t)(uintptr_t)physical, pages_needed, PAGE_OWNER_HEAP);
 
-        heap_size += pages_needed * PAGE_SIZE;
-        kprintf("HEAP: Expanded by %d KB (virtual)\n", (pages_needed * PAGE_SIZE) / 1024);
+    heap_add_pool(phys_to_virt((uint64_t)(uintptr_t)physical), (uint64_t)pages_needed * PAGE_SIZE);
+    kprintf("HEAP: Expanded by %d KB (%s)\n", pages_needed * (PAGE_SIZE / 1024),
+            paging_enabled ? "physmap" : "physical");
 
-    } else {
-        // Without paging, allocate physical memory directly
-        void* new_mem = alloc_pages(pages_needed);
-        if (!new_mem) {
-            kprintf("HEAP: Failed to expand (physical)\n");
-            return -1;
-        }
+    return 0;
+}
 
-        heap_block_t* new_block = (heap_block_t*)new_mem;
-        new_block->size = (pages_needed * PAGE_SIZE) - sizeof(heap_block_t);
-        new_block->is_free = 1;
-        new_block->next = NULL;
-        new_block->prev = NULL;
+// Take a block off the free lists, charge it to a site and return it
+static void* block_claim(heap_block_t* block, uint64_t adjusted, size_t size, uint32_t site) {
+    block_trim_free(block, adjusted);
+    block_mark_used(block);
+    block->site = site;
+    block->requested = (uint32_t)size;
+    stat_used_size += block_size(block);
+    site_charge(site, size);
 
-        // Link to existing heap
-        heap_block_t* current = heap_start;
-        while (current->next) {
-            current = current->next;
-        }
-        current->next = new_block;
-        new_block->prev = current;
+    return block_to_ptr(block);
+}
 
-        heap_size += pages_needed * PAGE_SIZE;
-        kprintf("HEAP: Expanded by %d KB (physical)\n", (pages_needed * PAGE_SIZE) / 1024);
+static void* heap_alloc(size_t size, uint32_t site) {
+    if (size >= HEAP_LARGE_THRESHOLD) {
+        return large_alloc(size, site);
     }
 
-    return 0;
-}
+    uint64_t adjusted = adjust_request_size(size);
+    if (!adjusted) return NULL;
 
-// Find free block using first-fit strategy
-static heap_block_t* find_free_block(size_t size) {
-    heap_block_t* current = heap_start;
+    heap_block_t* block = locate_free_block(adjusted);
 
-    while (current) {
-        if (current->is_free && current->size >= size) {
-            return current;
+    // If no block found, try to expand heap
+    if (!block) {
+        if (expand_heap(adjusted) < 0) {
+            kprintf("HEAP: Out of memory! Requested: %d bytes\n", (uint32_t)size);
+            return NULL;
         }
-        current = current->next;
+        block = locate_free_block(adjusted);
+        if (!block) return NULL;
     }
 
-    return NULL;
+    remove_free_block(block);
+    return block_claim(block, adjusted, size, site);
 }
 
-// Split block if it's too large
-static void split_block(heap_block_t* block, size_t size) {
-    if (block->size >= size + sizeof(heap_block_t) + MIN_BLOCK_SIZE) {
-        heap_block_t* new_block = (heap_block_t*)((uint8_t*)block + sizeof(heap_block_t) + size);
-        new_block->size = block->size - size - sizeof(heap_block_t);
-        new_block->is_free = 1;
-        new_block->next = block->next;
-        new_block->prev = block;
-
-        if (block->next) {
-            block->next->prev = new_block;
-        }
-
-        block->next = new_block;
-        block->size = size;
-    }
+void* kmalloc(size_t size) {
+    return heap_alloc(size, CALLER_SITE());
 }
 
-// Merge adjacent free blocks
-static void coalesce_blocks(heap_block_t* block) {
-    // Merge with next block if it's free
-    if (block->next && block->next->is_free) {
-        block->size += sizeof(heap_block_t) + block->next->size;
-        block->next = block->next->next;
+void* kmalloc_tagged(size_t size, const char* tag) {
+    return heap_alloc(size, site_lookup(tag, 0));
+}
 
-        if (block->next) {
-            block->next->prev = block;
-        }
+void* kmalloc_aligned(size_t size, size_t alignment) {
+    if (alignment & (alignment - 1)) {
+        kprintf("HEAP: Alignment %d is not a power of two\n", (uint32_t)alignment);
+        return NULL;
     }
-
-    // Merge with previous block if it's free
-    if (block->prev && block->prev->is_free) {
-        block->prev->size += sizeof(heap_block_t) + block->size;
-        block->prev->next = block->next;
-
-        if (block->next) {
-            block->next->prev = block->prev;
-        }
+    uint32_t site = CALLER_SITE();
+    if (alignment <= HEAP_ALIGN_SIZE) {
+        return heap_alloc(size, site);
+    }
+    if (size >= HEAP_LARGE_THRESHOLD && alignment <= PAGE_SIZE) {
+        return large_alloc(size, site);
     }
-}
-
-void* kmalloc(size_t size) {
-    if (size == 0) return NULL;
 
-    // Align size to 8 bytes
-    size = (size + 7) & ~7;
+    uint64_t adjusted = adjust_request_size(size);
+    if (!adjusted) return NULL;
 
-    // Find free block
-    heap_block_t* block = find_free_block(size);
+    // A leading gap must be big enough to stand alone as a free block
+    uint64_t gap_minimum = sizeof(heap_block_t);
+    uint64_t search_size = adjusted + alignment + gap_minimum;
+    if (search_size > HEAP_MAX_ALLOC) return NULL;
 
-    // If no block found, try to expand heap
+    heap_block_t* block = locate_free_block(search_size);
     if (!block) {
-        if (expand_heap(size + sizeof(heap_block_t) + 4096) < 0) {
-            kprintf("HEAP: Out of memory! Requested: %d bytes\n", size);
+        if (expand_heap(search_size) < 0) {
+            kprintf("HEAP: Out of memory! Requested: %d bytes aligned to %d\n",
+                    (uint32_t)size, (uint32_t)alignment);
             return NULL;
         }
-        block = find_free_block(size);
+        block = locate_free_block(search_size);
         if (!block) return NULL;
     }
 
-    // Split block if needed
-    split_block(block, size);
+    remove_free_block(block);
 
-    // Mark as allocated
-    block->is_free = 0;
+    uintptr_t ptr = (uintptr_t)block_to_ptr(block);
+    uintptr_t aligned = ALIGN_UP(ptr, alignment);
+    uint64_t gap = aligned - ptr;
+    if (gap && gap < gap_minimum) {
+        aligned = ALIGN_UP(ptr + gap_minimum, alignment);
+        gap = aligned - ptr;
+    }
 
-    // Return pointer to usable memory (after header)
-    return (void*)((uint8_t*)block + sizeof(heap_block_t));
-}
+    // Return the leading gap to the free lists; nothing is over-allocated
+    if (gap) {
+        heap_block_t* leading = block;
+        block = block_split(leading, gap - HEAP_BLOCK_OVERHEAD);
+        block_mark_free(leading);
+        insert_free_block(leading);
+    }
 
-void* kmalloc_aligned(size_t size, size_t alignment) {
-    size_t total_size = size + alignment + sizeof(heap_block_t);
-    void* ptr = kmalloc(total_size);
+    return block_claim(block, adjusted, size, site);
+}
 
-    if (!ptr) return NULL;
+void kfree(void* ptr) {
+    if (!ptr) return;
 
-    // Calculate aligned address
-    uintptr_t addr = (uintptr_t)ptr;
-    uintptr_t aligned = (addr + alignment - 1) & ~(alignment - 1);
+    // Large allocations are always page aligned; heap blocks rarely are
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) == 0 && large_free(ptr)) {
+        return;
+    }
 
-    if (aligned == addr) {
-        return ptr;
+    heap_block_t* block = ptr_to_block(ptr);
+    if (block->size & BLOCK_FREE) {
+        kprintf("HEAP: Double free of %x\n", (uint32_t)(uintptr_t)ptr);
+        return;
     }
 
-    return ptr;
+    stat_used_size -= block_size(block);
+    site_uncharge(block->site, block->requested);
+    block_release(block);
 }
 
-void kfree(void* ptr) {
-    if (!ptr) return;
+size_t ksize(const void* ptr) {
+    if (!ptr) return 0;
 
-    // Get block header
-    heap_block_t* block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) == 0) {
+        heap_large_t* large = large_find((void*)ptr);
+        if (large) return (size_t)large->requested;
+    }
+    return ptr_to_block((void*)ptr)->requested;
+}
 
-    // Mark as free
-    block->is_free = 1;
+// Resize a block's charge in place, keeping its site
+static void block_recharge(heap_block_t* block, size_t new_size) {
+    heap_site_t* site = &sites[block->site];
+    site->live_bytes = site->live_bytes - block->requested + new_size;
+    block->requested = (uint32_t)new_size;
 
-    // Coalesce with adjacent free blocks
-    coalesce_blocks(block);
+    uint64_t used = stat_used_size + stat_large_size;
+    if (used > stat_peak_used) {
+        stat_peak_used = used;
+    }
 }
 
 void* krealloc(void* ptr, size_t new_size) {
     if (!ptr) {
-        return kmalloc(new_size);
+        return heap_alloc(new_size, CALLER_SITE());
     }
 
     if (new_size == 0) {
@@ -243,20 +630,56 @@ void* krealloc(void* ptr, size_t new_size) {
         return NULL;
     }
 
-    // Get current block
-    heap_block_t* block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
+    heap_large_t* large = ((uintptr_t)ptr & (PAGE_SIZE - 1)) ? NULL : large_find(ptr);
+    if (large) {
+        if (new_size <= large->size) {
+            // Still fits its pages: only the charge changes
+            sites[large->site].live_bytes += new_size - large->requested;
+            large->requested = new_size;
+            return ptr;
+        }
+
+        void* new_ptr = heap_alloc(new_size, large->site);
+        if (!new_ptr) return NULL;
+
+        memcpy(new_ptr, ptr, large->size);
+        kfree(ptr);
+        return new_ptr;
+    }
+
+    uint64_t adjusted = adjust_request_size(new_size);
+    if (!adjusted) return NULL;
 
-    // If new size fits in current block, return same pointer
-    if (block->size >= new_size) {
+    heap_block_t* block = ptr_to_block(ptr);
+    uint64_t current = block_size(block);
+
+    // Shrinking (or already large enough): give the tail back in place
+    if (adjusted <= current) {
+        block_trim_used(block, adjusted);
+        block_recharge(block, new_size);
+        return ptr;
+    }
+
+    // Grow in place by absorbing a free physical successor
+    heap_block_t* next = block_next(block);
+    if (new_size < HEAP_LARGE_THRESHOLD && (next->size & BLOCK_FREE) &&
+        current + HEAP_BLOCK_OVERHEAD + block_size(next) >= adjusted) {
+        remove_free_block(next);
+        block->size += HEAP_BLOCK_OVERHEAD + block_size(next);
+        stat_num_blocks--;
+        block_mark_used(block);
+        stat_used_size += block_size(block) - current;
+        block_trim_used(block, adjusted);
+        block_recharge(block, new_size);
         return ptr;
     }
 
     // Allocate new block
-    void* new_ptr = kmalloc(new_size);
+    void* new_ptr = heap_alloc(new_size, block->site);
     if (!new_ptr) return NULL;
 
     // Copy data
-    memcpy(new_ptr, ptr, block->size < new_size ? block->size : new_size);
+    memcpy(new_ptr, ptr, current);
 
     // Free old block
     kfree(ptr);
@@ -267,26 +690,78 @@ void* krealloc(void* ptr, size_t new_size) {
 void heap_get_stats(heap_stats_t* stats) {
     if (!stats) return;
 
-    stats->total_size = 0;
-    stats->used_size = 0;
-    stats->free_size = 0;
-    stats->num_blocks = 0;
-    stats->num_free_blocks = 0;
-
-    heap_block_t* current = heap_start;
-    while (current) {
-        stats->num_blocks++;
-        stats->total_size += current->size + sizeof(heap_block_t);
-
-        if (current->is_free) {
-            stats->num_free_blocks++;
-            stats->free_size += current->size;
-        } else {
-            stats->used_size += current->size;
+    stats->total_size = heap_size;
+    stats->used_size = stat_used_size;
+    stats->free_size = stat_free_size;
+    stats->num_blocks = stat_num_blocks;
+    stats->num_free_blocks = stat_num_free_blocks;
+    stats->large_size = stat_large_size;
+    stats->num_large = stat_num_large;
+}
+
+// Largest free block: the highest non-empty list holds it, so only that
+// one list is scanned.
+static uint64_t largest_free_block(void) {
+    if (!fl_bitmap) return 0;
+
+    uint32_t fl = fls64(fl_bitmap);
+    uint32_t sl = 31 - __builtin_clz(sl_bitmap[fl]);
+
+    uint64_t largest = 0;
+    for (heap_block_t* block = free_lists[fl][sl]; block; block = block->next_free) {
+        if (block_size(block) > largest) {
+            largest = block_size(block);
         }
+    }
+    return largest;
+}
+
+void heap_get_profile(heap_profile_t* profile) {
+    if (!profile) return;
+
+    profile->used_size = stat_used_size + stat_large_size;
+    profile->peak_used = stat_peak_used;
+    profile->free_size = stat_free_size;
+    profile->largest_free = largest_free_block();
+    profile->frag_permille = stat_free_size
+        ? (uint32_t)(1000 - profile->largest_free * 1000 / stat_free_size) : 0;
+    profile->num_sites = stat_num_sites;
+
+    for (uint32_t i = 0; i < HEAP_HIST_BUCKETS; i++) {
+        profile->histogram[i] = stat_histogram[i];
+    }
+}
 
-        current = current->next;
+const heap_site_t* heap_get_site(uint32_t index) {
+    if (index >= HEAP_MAX_SITES || (index != SITE_OVERFLOW && !sites[index].total_allocs)) {
+        return NULL;
     }
+    return &sites[index];
+}
+
+void heap_profile_dump(void) {
+    heap_profile_t profile;
+    heap_get_profile(&profile);
+
+    kprintf("HEAPSTAT used=%u peak=%u free=%u largest_free=%u frag_permille=%u sites=%u large=%u\n",
+            (uint32_t)profile.used_size, (uint32_t)profile.peak_used,
+            (uint32_t)profile.free_size, (uint32_t)profile.largest_free,
+            profile.frag_permille, profile.num_sites, stat_num_large);
+
+    for (uint32_t i = 0; i < HEAP_MAX_SITES; i++) {
+        const heap_site_t* site = heap_get_site(i);
+        if (!site || !site->total_allocs) continue;
+
+        kprintf("HEAPSITE index=%u tag=%s caller=%x bytes=%u live=%u allocs=%u\n",
+                i, site->tag ? site->tag : "-", (uint32_t)site->caller,
+                (uint32_t)site->live_bytes, site->live_allocs, site->total_allocs);
+    }
+
+    for (uint32_t i = 0; i < HEAP_HIST_BUCKETS - 1; i++) {
+        kprintf("HEAPHIST le=%u count=%u\n", 16u << i, profile.histogram[i]);
+    }
+    kprintf("HEAPHIST le=max count=%u\n", profile.histogram[HEAP_HIST_BUCKETS - 1]);
+    kprintf("HEAPSTAT end\n");
 }
 
 void heap_debug_print(void) {
@@ -294,16 +769,19 @@ void heap_debug_print(void) {
     kprintf("Heap start: %x (%s mode)\n", heap_start,
             paging_enabled ? "virtual" : "physical");
 
-    heap_block_t* current = heap_start;
     int block_num = 0;
 
-    while (current && block_num < 20) {  // Limit output
-        kprintf("Block %d: addr=%x size=%d %s\n",
-                block_num++,
-                current,
-                current->size,
-                current->is_free ? "FREE" : "USED");
-        current = current->next;
+    for (heap_pool_t* pool = heap_pools; pool && block_num < 20; pool = pool->next) {
+        heap_block_t* current = (heap_block_t*)((uint8_t*)pool + sizeof(heap_pool_t));
+
+        while (block_size(current) && block_num < 20) {  // Limit output
+            kprintf("Block %d: addr=%x size=%d %s\n",
+                    block_num++,
+                    current,
+                    (uint32_t)block_size(current),
+                    (current->size & BLOCK_FREE) ? "FREE" : "USED");
+            current = block_next(current);
+        }
     }
 
     heap_stats_t stats;
@@ -311,8 +789,10 @@ void heap_debug_print(void) {
 
     kprintf("\nTotal blocks: %d\n", stats.num_blocks);
     kprintf("Free blocks: %d\n", stats.num_free_blocks);
-    kprintf("Total size: %d MB\n", stats.total_size / 1024 / 1024);
-    kprintf("Used size: %d KB\n", stats.used_size / 1024);
-    kprintf("Free size: %d MB\n", stats.free_size / 1024 / 1024);
+    kprintf("Total size: %d MB\n", (uint32_t)(stats.total_size / 1024 / 1024));
+    kprintf("Used size: %d KB\n", (uint32_t)(stats.used_size / 1024));
+    kprintf("Free size: %d MB\n", (uint32_t)(stats.free_size / 1024 / 1024));
+    kprintf("Large allocations: %d (%d KB)\n", stats.num_large,
+            (uint32_t)(stats.large_size / 1024));
     kprintf("==================\n\n");
 }
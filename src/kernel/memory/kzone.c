@@ -0,0 +1,147 @@
+// src/kernel/memory/kzone.c - Named allocation zones with quotas and accounting
+#include "kzone.h"
+#include "heap.h"
+#include "paging.h"
+#include "physical_mm.h"
+#include "kstring.h"
+#include "serial.h"
+
+static kzone_t zones[KZONE_MAX];
+static uint32_t zone_count = 0;
+
+// Set while free memory is below the low watermark and reclaim has run
+static int below_watermark = 0;
+static int reclaiming = 0;
+
+kzone_t* kzone_create(const char* name, uint64_t quota) {
+    for (uint32_t i = 0; i < zone_count; i++) {
+        if (strcmp(zones[i].name, name) == 0) {
+            zones[i].quota = quota;
+            return &zones[i];
+        }
+    }
+
+    if (zone_count == KZONE_MAX) {
+        kprintf("KZONE: No room for zone '%s'\n", name);
+        return NULL;
+    }
+
+    kzone_t* zone = &zones[zone_count++];
+    memset(zone, 0, sizeof(kzone_t));
+    strncpy(zone->name, name, KZONE_NAME_LEN - 1);
+    zone->quota = quota;
+
+    kprintf("KZONE: Created zone '%s' (quota %u KB)\n", zone->name, (uint32_t)(quota / 1024));
+    return zone;
+}
+
+void kzone_set_reclaim(kzone_t* zone, kzone_reclaim_t reclaim) {
+    if (zone) zone->reclaim = reclaim;
+}
+
+// Reserve `bytes` against the quota; 0 if that would exceed it
+static int zone_charge(kzone_t* zone, uint64_t bytes) {
+    if (zone->quota && zone->live + bytes > zone->quota) {
+        zone->denied++;
+        kprintf("KZONE: '%s' over quota (%u KB live + %u KB > %u KB)\n", zone->name,
+                (uint32_t)(zone->live / 1024), (uint32_t)(bytes / 1024),
+                (uint32_t)(zone->quota / 1024));
+        return 0;
+    }
+
+    zone->live += bytes;
+    zone->allocs++;
+    if (zone->live > zone->peak) {
+        zone->peak = zone->live;
+    }
+    return 1;
+}
+
+static void zone_uncharge(kzone_t* zone, uint64_t bytes) {
+    zone->live -= bytes;
+    zone->allocs--;
+}
+
+void* kzone_alloc(kzone_t* zone, size_t size) {
+    if (!zone) return kmalloc(size);
+
+    kzone_check_watermark();
+    if (!zone_charge(zone, size)) return NULL;
+
+    void* ptr = kmalloc_tagged(size, zone->name);
+    if (!ptr) zone_uncharge(zone, size);
+    return ptr;
+}
+
+void kzone_free(kzone_t* zone, void* ptr) {
+    if (!ptr) return;
+    if (zone) zone_uncharge(zone, ksize(ptr));
+    kfree(ptr);
+}
+
+void* kzone_alloc_virtual(kzone_t* zone, size_t size, uint32_t flags) {
+    if (!zone) return kmalloc_virtual_flags(size, flags);
+
+    uint64_t bytes = ALIGN_UP((uint64_t)size, PAGE_SIZE);
+    kzone_check_watermark();
+    if (!zone_charge(zone, bytes)) return NULL;
+
+    void* ptr = kmalloc_virtual_flags(size, flags);
+    if (!ptr) zone_uncharge(zone, bytes);
+    return ptr;
+}
+
+void kzone_free_virtual(kzone_t* zone, void* ptr, size_t size) {
+    if (!ptr) return;
+    if (zone) zone_uncharge(zone, ALIGN_UP((uint64_t)size, PAGE_SIZE));
+    kfree_virtual(ptr, size);
+}
+
+uint64_t kzone_reclaim(uint64_t bytes) {
+    if (reclaiming) return 0;
+    reclaiming = 1;
+
+    // Largest zones first; each zone is asked once per call
+    uint32_t asked = 0;
+    uint64_t freed = 0;
+    while (freed < bytes) {
+        kzone_t* pick = NULL;
+        for (uint32_t i = 0; i < zone_count; i++) {
+            kzone_t* zone = &zones[i];
+            if (!zone->reclaim || (asked & (1u << i))) continue;
+            if (!pick || zone->live > pick->live) pick = zone;
+        }
+        if (!pick) break;
+
+        asked |= 1u << (uint32_t)(pick - zones);
+        uint64_t got = pick->reclaim(pick, bytes - freed);
+        pick->reclaim_calls++;
+        pick->reclaimed += got;
+        freed += got;
+    }
+
+    reclaiming = 0;
+    return freed;
+}
+
+void kzone_check_watermark(void) {
+    uint64_t free = get_free_memory();
+
+    if (free >= KZONE_HIGH_WATERMARK) {
+        below_watermark = 0;
+        return;
+    }
+    if (free >= KZONE_LOW_WATERMARK || below_watermark) return;
+
+    below_watermark = 1;
+    kprintf("KZONE: Free memory %u KB below watermark, reclaiming\n", (uint32_t)(free / 1024));
+    kzone_reclaim(KZONE_HIGH_WATERMARK - free);
+}
+
+uint32_t kzone_count(void) {
+    return zone_count;
+}
+
+const kzone_t* kzone_get(uint32_t index) {
+    return index < zone_count ? &zones[index] : NULL;
+}
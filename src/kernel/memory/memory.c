@@ -5,8 +5,37 @@
 // This variable is set by entry.asm before entering C
 extern uint32_t detected_memory_size;
 
+static const char* e820_type_name(uint32_t type) {
+    switch (type) {
+        case E820_TYPE_USABLE:   return "usable";
+        case E820_TYPE_RESERVED: return "reserved";
+        case E820_TYPE_ACPI:     return "ACPI data";
+        case E820_TYPE_NVS:      return "ACPI NVS";
+        case E820_TYPE_BAD:      return "bad";
+        default:                 return "unknown";
+    }
+}
+
+const e820_entry_t* memory_get_e820(uint32_t* count) {
+    bootinfo_t* info = (bootinfo_t*)(uintptr_t)BOOTINFO_ADDR;
+
+    uint32_t n = info->e820_count;
+    if (n > BOOTINFO_E820_MAX) n = 0;   // Garbage: no map was handed over
+
+    if (count) *count = n;
+    return info->e820;
+}
+
 uint32_t detect_memory_mb(void) {
-    kprintf("MEMORY: Detected %u MB RAM\n", detected_memory_size);
+    uint32_t count;
+    const e820_entry_t* map = memory_get_e820(&count);
+
+    kprintf("MEMORY: Detected %u MB RAM, %u E820 entries\n",
+            detected_memory_size, count);
+    for (uint32_t i = 0; i < count; i++) {
+        kprintf("MEMORY:   %llx - %llx %s\n", map[i].base,
+                map[i].base + map[i].length - 1, e820_type_name(map[i].type));
+    }
     return detected_memory_size;
 }
 
@@ -5,6 +5,9 @@
 #include "kstring.h"
 #include "memory.h"
 #include "serial.h"
+#include "zero_pool.h"
+#include "vmem.h"
+#include "zram.h"
 
 extern uint64_t framebuffer_address;
 extern uint64_t framebuffer_width;
@@ -13,59 +16,154 @@ extern uint64_t framebuffer_pitch;
 
 // Global kernel page directory (PML4)
 static page_directory_t* kernel_page_dir = 0;
+static uint64_t kernel_page_dir_phys = 0;
 
-// Page tables for each level (we'll allocate as needed)
-static page_table_t* kernel_page_tables[512][512] = {{0}};  // PDP and PD levels
+// Physmap: offset added to a physical address to reach it. Zero while we
+// still run on the bootloader's identity map, PHYSMAP_BASE afterwards.
+uint64_t physmap_offset = 0;
+static uint64_t physmap_size = 0;
+static uint32_t physmap_1gb_pages = 0;
+static uint32_t physmap_2mb_pages = 0;
+
+// Live 2MB mappings outside the identity map and physmap
+static uint32_t huge_mappings = 0;
+
+// Range changes that reloaded CR3 instead of issuing invlpg per page
+static uint32_t tlb_full_flushes = 0;
+
+// Demand-zero pages: faults served, and PAGE_LAZY entries still untouched
+static uint64_t lazy_faults = 0;
+static uint64_t lazy_pending = 0;
+
+// Copy-on-write faults, and the ones that had to copy the frame
+static uint64_t cow_faults = 0;
+static uint64_t cow_copies = 0;
+
+// Compaction totals since boot
+static paging_compact_stats_t compact_stats;
+static uint32_t compact_on_failure(uint32_t blocks);
+
+// KV_RECLAIM ranges swept by the reclaim clock (end == 0: unused)
+#define RECLAIM_MAX_RANGES 8
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint64_t hand;              // Clock hand of paging_reclaim_range()
+} reclaim_range_t;
+
+static reclaim_range_t reclaim_ranges[RECLAIM_MAX_RANGES];
+static uint32_t reclaim_hand_range = 0;
+static uint64_t reclaim_hand = 0;
+static paging_reclaim_stats_t reclaim_stats;
 
 // Current page directory
 page_directory_t* current_directory = 0;
+static uint16_t current_pcid = 0;
 
-// Kernel heap manager with free list support
-typedef struct free_region {
-    uint64_t start;
-    uint64_t size;
-    struct free_region* next;
-} free_region_t;
+// TLB features switched on by paging_init()
+static int pge_enabled = 0;
+static int pcid_enabled = 0;
 
-static uint64_t kernel_heap_next = KERNEL_HEAP_START;
-static free_region_t* free_list = NULL;
+// PAT entry 1 holds write-combining (see PAGE_WRITECOMBINE)
+#define MSR_IA32_PAT    0x277
+#define PAT_TYPE_WC     0x01ULL
+static int pat_wc_enabled = 0;
 
-// Allocate a small pool for free list nodes
-#define MAX_FREE_REGIONS 64
-static free_region_t free_region_pool[MAX_FREE_REGIONS];
-static uint32_t free_region_pool_used = 0;
+// PCID allocation. A PCID's cached translations are trusted only while its
+// flush generation is current; unmapping in an address space that is not
+// loaded bumps the generation, so every PCID is flushed on its next load.
+static uint64_t pcid_used[PCID_COUNT / 64];
+static uint32_t pcid_flushed[PCID_COUNT];
+static uint32_t pcid_generation = 1;
+
+// Kernel virtual address space for kmalloc_virtual()
+static vmem_t kernel_vmem;
+static int kernel_vmem_ready = 0;
 
 extern void load_page_directory(uint64_t);
 extern void enable_paging_asm(void);
 
+#define ENTRY_FRAME_MASK 0x000FFFFFFFFFF000ULL
+
+// Bits a kernel-heap page keeps while it moves between demand-zero,
+// resident and zram states
+#define LEAF_KEEP_FLAGS (PAGE_WRITABLE | PAGE_USER | PAGE_WRITETHROUGH | \
+                         PAGE_CACHE_DISABLE | PAGE_GLOBAL | PAGE_RECLAIM)
+
+// Write a whole entry: frame plus flag bits
+static inline void set_entry(page_table_entry_t* entry, uint64_t physical_addr, uint64_t flags) {
+    *(uint64_t*)entry = (physical_addr & ENTRY_FRAME_MASK) | flags;
+}
+
+static inline uint64_t entry_value(const page_table_entry_t* entry) {
+    return *(const uint64_t*)entry;
+}
+
+// Large page (PS bit) in a PDP or PD entry
+static inline int entry_is_huge(page_table_entry_t* entry) {
+    return (entry_value(entry) & PAGE_HUGE) != 0;
+}
+
+// Kernel page directory leaves are shared by every address space and
+// marked global so they survive CR3 loads; user leaves never are
+static inline uint64_t global_flag(page_directory_t* pml4, uint64_t flags) {
+    return (pml4 == kernel_page_dir && !(flags & PAGE_USER)) ? PAGE_GLOBAL : 0;
+}
+
+// Next-level table an entry points at, through the physmap
+static inline page_table_t* entry_table(page_table_entry_t* entry) {
+    return (page_table_t*)phys_to_virt(entry->frame << 12);
+}
+
+// Zeroed page-table page, normally straight from the pre-zeroed pool;
+// returns its physical address in *physical
+static page_table_t* alloc_table(uint64_t* physical) {
+    void* page = alloc_page_zeroed();
+    if (!page) {
+        kprintf("PAGING: Out of memory for page table\n");
+        return NULL;
+    }
+
+    *physical = (uint64_t)(uintptr_t)page;
+    page_set_owner(*physical, 1, PAGE_OWNER_PAGETABLE);
+    return (page_table_t*)phys_to_virt(*physical);
+}
+
 // Helper: Get physical address from virtual address
 uint64_t get_physical_address(page_directory_t* pml4, uint64_t virtual_addr) {
-    (void)pml4;  // We use kernel_page_dir for now
-    
+    if (!pml4) pml4 = kernel_page_dir;
+
     uint64_t pml4_idx = PML4_INDEX(virtual_addr);
     uint64_t pdp_idx = PDP_INDEX(virtual_addr);
     uint64_t pd_idx = PD_INDEX(virtual_addr);
     uint64_t pt_idx = PT_INDEX(virtual_addr);
 
     // Check PML4 entry
-    if (!kernel_page_dir->entries[pml4_idx].present) {
+    if (!pml4->entries[pml4_idx].present) {
         return 0;
     }
 
     // Get PDP table
-    page_table_t* pdp = (page_table_t*)(kernel_page_dir->entries[pml4_idx].frame << 12);
+    page_table_t* pdp = entry_table(&pml4->entries[pml4_idx]);
     if (!pdp->entries[pdp_idx].present) {
         return 0;
     }
+    if (entry_is_huge(&pdp->entries[pdp_idx])) {
+        return (pdp->entries[pdp_idx].frame << 12) + (virtual_addr & (PAGE_SIZE_1G - 1));
+    }
 
     // Get PD table
-    page_table_t* pd = (page_table_t*)(pdp->entries[pdp_idx].frame << 12);
+    page_table_t* pd = entry_table(&pdp->entries[pdp_idx]);
     if (!pd->entries[pd_idx].present) {
         return 0;
     }
+    if (entry_is_huge(&pd->entries[pd_idx])) {
+        return (pd->entries[pd_idx].frame << 12) + (virtual_addr & (PAGE_SIZE_2M - 1));
+    }
 
     // Get PT table
-    page_table_t* pt = (page_table_t*)(pd->entries[pd_idx].frame << 12);
+    page_table_t* pt = entry_table(&pd->entries[pd_idx]);
     if (!pt->entries[pt_idx].present) {
         return 0;
     }
@@ -73,10 +171,107 @@ uint64_t get_physical_address(page_directory_t* pml4, uint64_t virtual_addr) {
     return (pt->entries[pt_idx].frame << 12) | (virtual_addr & 0xFFF);
 }
 
+uint64_t virt_to_phys(const void* virt) {
+    uint64_t addr = (uint64_t)(uintptr_t)virt;
+
+    if (addr >= PHYSMAP_BASE && addr < PHYSMAP_BASE + physmap_size) {
+        return addr - PHYSMAP_BASE;
+    }
+    if (physmap_offset == 0 || addr < BOOT_IDENTITY_SIZE) {
+        return addr;   // Identity-mapped
+    }
+    return get_physical_address(kernel_page_dir, addr);
+}
+
 void switch_page_directory(page_directory_t* pml4) {
+    switch_page_directory_pcid(pml4, 0);
+}
+
+void switch_page_directory_pcid(page_directory_t* pml4, uint16_t pcid) {
+    uint64_t cr3 = virt_to_phys(pml4);
+
+    if (pcid_enabled) {
+        if (pcid >= PCID_COUNT) pcid = 0;
+
+        if (pcid == 0 && pml4 != kernel_page_dir) {
+            // Borrowed kernel tag: flushed now, and again when the
+            // kernel directory is next loaded
+            pcid_flushed[0] = 0;
+        } else if (pcid_flushed[pcid] == pcid_generation) {
+            cr3 |= CR3_NOFLUSH;
+        } else {
+            pcid_flushed[pcid] = pcid_generation;
+        }
+        cr3 |= pcid;
+    }
+
     current_directory = pml4;
-    uint64_t pml4_physical = (uint64_t)pml4;
-    load_page_directory(pml4_physical);
+    current_pcid = pcid;
+    load_cr3(cr3);
+}
+
+uint16_t paging_alloc_pcid(void) {
+    if (!pcid_enabled) return 0;
+
+    for (uint32_t w = 0; w < PCID_COUNT / 64; w++) {
+        if (pcid_used[w] == ~0ULL) continue;
+
+        uint16_t pcid = (uint16_t)(w * 64 + __builtin_ctzll(~pcid_used[w]));
+        pcid_used[w] |= 1ULL << (pcid % 64);
+        pcid_flushed[pcid] = 0;   // Entries of an earlier owner go on first load
+        return pcid;
+    }
+    return 0;
+}
+
+void paging_free_pcid(uint16_t pcid) {
+    if (pcid == 0 || pcid >= PCID_COUNT) return;
+    pcid_used[pcid / 64] &= ~(1ULL << (pcid % 64));
+    pcid_flushed[pcid] = 0;
+}
+
+int paging_pcid_enabled(void) {
+    return pcid_enabled;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Turn PAT entry 1 into write-combining. Nothing maps with PWT before this
+// runs; caches are written back around the change and the TLB is reloaded
+// when paging_init() loads the new page tables.
+static void paging_init_pat(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(1), "c"(0));
+    if (!((edx >> 16) & 1)) {
+        kprintf("PAGING: No PAT, framebuffer keeps its MTRR memory type\n");
+        return;
+    }
+
+    uint64_t pat = rdmsr(MSR_IA32_PAT);
+    pat = (pat & ~(0xFFULL << 8)) | (PAT_TYPE_WC << 8);
+
+    __asm__ volatile("wbinvd" : : : "memory");
+    wrmsr(MSR_IA32_PAT, pat);
+    __asm__ volatile("wbinvd" : : : "memory");
+
+    pat_wc_enabled = 1;
+    kprintf("PAGING: PAT programmed (entry 1 = write-combining)\n");
 }
 
 static void paging_map_framebuffer(void) {
@@ -101,71 +296,147 @@ static void paging_map_framebuffer(void) {
     // Align to page boundary
     uint64_t fb_start = framebuffer_address & ~0xFFF;
     
-    // Identity map all framebuffer pages
-    for (uint64_t i = 0; i < fb_pages; i++) {
-        uint64_t phys_addr = fb_start + (i * PAGE_SIZE);
-        uint64_t virt_addr = phys_addr;  // Identity mapping
-        
-        map_page(kernel_page_dir, virt_addr, phys_addr, PAGE_WRITABLE);
-    }
+    // Identity map all framebuffer pages, write-combining so pixel stores
+    // are merged into burst writes instead of one bus cycle each
+    map_range(kernel_page_dir, fb_start, fb_start, fb_pages * PAGE_SIZE,
+              PAGE_WRITABLE | PAGE_HUGE | (pat_wc_enabled ? PAGE_WRITECOMBINE : 0));
     
-    kprintf("PAGING: Framebuffer mapped successfully\n");
+    kprintf("PAGING: Framebuffer mapped successfully (%s)\n",
+            pat_wc_enabled ? "write-combining" : "default caching");
+}
+
+static int cpu_has_1gb_pages(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(0x80000000), "c"(0));
+    if (eax < 0x80000001) return 0;
+
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(0x80000001), "c"(0));
+    return (edx >> 26) & 1;   // Page1GB
+}
+
+// CR4.PGE for the global kernel entries, then CR4.PCIDE. PCIDs are only
+// used together with global pages, so a full kernel flush (PGE toggle)
+// also reaches every PCID. Must run while CR3 carries PCID 0.
+static void paging_enable_tlb_features(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(1), "c"(0));
+
+    if ((edx >> 13) & 1) {
+        write_cr4(read_cr4() | CR4_PGE);
+        pge_enabled = 1;
+    }
+    if (pge_enabled && ((ecx >> 17) & 1)) {
+        write_cr4(read_cr4() | CR4_PCIDE);
+        pcid_enabled = 1;
+        pcid_used[0] |= 1;                        // Kernel page directory
+        pcid_flushed[0] = pcid_generation;
+    }
+
+    kprintf("PAGING: Global pages %s, PCID %s\n",
+            pge_enabled ? "on" : "unsupported", pcid_enabled ? "on" : "unsupported");
+}
+
+// Map [0, size) at PHYSMAP_BASE with 1GB pages where the CPU has them,
+// 2MB pages otherwise
+static void paging_build_physmap(uint64_t size) {
+    int use_1gb = cpu_has_1gb_pages();
+    uint64_t flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_HUGE | PAGE_GLOBAL;
+
+    size = ALIGN_UP(size, use_1gb ? PAGE_SIZE_1G : PAGE_SIZE_2M);
+    if (size > PHYSMAP_MAX_SIZE) size = PHYSMAP_MAX_SIZE;
+
+    kprintf("PAGING: Building physmap of %u MB at 0x%llx (%s pages)...\n",
+            (uint32_t)(size >> 20), PHYSMAP_BASE, use_1gb ? "1GB" : "2MB");
+
+    for (uint64_t phys = 0; phys < size; phys += PAGE_SIZE_1G) {
+        uint64_t virt = PHYSMAP_BASE + phys;
+        page_table_entry_t* pml4e = &kernel_page_dir->entries[PML4_INDEX(virt)];
+        uint64_t table_phys;
+
+        if (!pml4e->present) {
+            if (!alloc_table(&table_phys)) break;
+            set_entry(pml4e, table_phys, PAGE_PRESENT | PAGE_WRITABLE);
+        }
+        page_table_t* pdp = entry_table(pml4e);
+        page_table_entry_t* pdpe = &pdp->entries[PDP_INDEX(virt)];
+
+        if (use_1gb) {
+            set_entry(pdpe, phys, flags);
+            physmap_1gb_pages++;
+            continue;
+        }
+
+        page_table_t* pd = alloc_table(&table_phys);
+        if (!pd) break;
+        set_entry(pdpe, table_phys, PAGE_PRESENT | PAGE_WRITABLE);
+
+        for (uint32_t i = 0; i < 512 && phys + i * PAGE_SIZE_2M < size; i++) {
+            set_entry(&pd->entries[i], phys + i * PAGE_SIZE_2M, flags);
+            physmap_2mb_pages++;
+        }
+    }
+
+    physmap_size = (uint64_t)physmap_1gb_pages * PAGE_SIZE_1G
+                 + (uint64_t)physmap_2mb_pages * PAGE_SIZE_2M;
 }
 
 void paging_init(void) {
     kprintf("PAGING: Initializing x86_64 4-level paging...\n");
 
-    // Create kernel PML4 (top-level page directory)
-    kernel_page_dir = (page_directory_t*)alloc_page();
-    memset(kernel_page_dir, 0, sizeof(page_directory_t));
+    // Page tables are written through the bootloader's identity map until
+    // the switch below; phys_to_virt() is the identity until then
+    kernel_page_dir = alloc_table(&kernel_page_dir_phys);
 
-    // Identity map first 32MB using 2MB huge pages for simplicity
+    // Identity map first 32MB using 2MB huge pages for simplicity.
+    // The kernel image, its stack and early boot allocations live here.
     kprintf("PAGING: Creating identity mapping for first 32MB...\n");
 
     // We need: PML4[0] -> PDP[0] -> PD[0..15] with 2MB pages
-    // For 32MB: 16 x 2MB pages
-    
-    // Allocate PDP for first PML4 entry
-    page_table_t* pdp = (page_table_t*)alloc_page();
-    memset(pdp, 0, sizeof(page_table_t));
-    
-    kernel_page_dir->entries[0].present = 1;
-    kernel_page_dir->entries[0].rw = 1;
-    kernel_page_dir->entries[0].user = 0;
-    kernel_page_dir->entries[0].frame = ((uint64_t)pdp) >> 12;
-    
-    // Allocate PD for first PDP entry
-    page_table_t* pd = (page_table_t*)alloc_page();
-    memset(pd, 0, sizeof(page_table_t));
-    
-    pdp->entries[0].present = 1;
-    pdp->entries[0].rw = 1;
-    pdp->entries[0].user = 0;
-    pdp->entries[0].frame = ((uint64_t)pd) >> 12;
-    
-    // Create 16 x 2MB huge pages (32MB total)
-    for (uint32_t i = 0; i < 16; i++) {
-        pd->entries[i].present = 1;
-        pd->entries[i].rw = 1;
-        pd->entries[i].user = 0;
-        pd->entries[i].pat = 1;  // Use as huge page bit
-        pd->entries[i].frame = (i * 0x200000) >> 12;  // 2MB increments
+    uint64_t pdp_phys = 0, pd_phys = 0;
+    page_table_t* pdp = alloc_table(&pdp_phys);
+    page_table_t* pd = alloc_table(&pd_phys);
+
+    set_entry(&kernel_page_dir->entries[0], pdp_phys, PAGE_PRESENT | PAGE_WRITABLE);
+    set_entry(&pdp->entries[0], pd_phys, PAGE_PRESENT | PAGE_WRITABLE);
+
+    // Create 16 x 2MB huge pages (32MB total). This also covers the VGA
+    // text buffer at 0xB8000.
+    for (uint32_t i = 0; i < BOOT_IDENTITY_SIZE / PAGE_SIZE_2M; i++) {
+        set_entry(&pd->entries[i], (uint64_t)i * PAGE_SIZE_2M,
+                  PAGE_PRESENT | PAGE_WRITABLE | PAGE_HUGE | PAGE_GLOBAL);
     }
 
     kprintf("PAGING: Identity mapping complete (using 2MB pages)\n");
-    
-    // Map VGA buffer
-    kprintf("PAGING: Mapping VGA buffer...\n");
-    map_page(kernel_page_dir, 0xB8000, 0xB8000, PAGE_WRITABLE);
+
+    // All RAM, in the higher half
+    paging_build_physmap(pmm_get_phys_end());
 
     // Map framebuffer (if present)
+    paging_init_pat();
     paging_map_framebuffer();
 
     kprintf("PAGING: Enabling paging...\n");
-    switch_page_directory(kernel_page_dir);
+    load_page_directory(kernel_page_dir_phys);
 
     enable_paging_asm();
+    paging_enable_tlb_features();
 
+    // From here on page tables and PMM pages are reached via the physmap
+    physmap_offset = PHYSMAP_BASE;
+    kernel_page_dir = (page_directory_t*)phys_to_virt(kernel_page_dir_phys);
+    current_directory = kernel_page_dir;
+
+    kprintf("PAGING: Physmap live: %u x 1GB, %u x 2MB pages\n",
+            physmap_1gb_pages, physmap_2mb_pages);
+
+    // Failed allocations reclaim, and large ones compact, before giving up
+    pmm_set_reclaim_handler(paging_reclaim);
+    pmm_set_compact_handler(compact_on_failure);
     kprintf("PAGING: Virtual memory enabled successfully!\n");
 }
 
@@ -174,182 +445,588 @@ void map_page(page_directory_t* pml4, uint64_t virtual_addr, uint64_t physical_a
     uint64_t pdp_idx = PDP_INDEX(virtual_addr);
     uint64_t pd_idx = PD_INDEX(virtual_addr);
     uint64_t pt_idx = PT_INDEX(virtual_addr);
+    uint64_t table_flags = PAGE_PRESENT | PAGE_WRITABLE | (flags & PAGE_USER);
+    uint64_t table_phys;
 
     // Ensure PML4 entry exists
     if (!pml4->entries[pml4_idx].present) {
-        page_table_t* pdp = (page_table_t*)alloc_page();
-        memset(pdp, 0, sizeof(page_table_t));
-        
-        pml4->entries[pml4_idx].present = 1;
-        pml4->entries[pml4_idx].rw = 1;
-        pml4->entries[pml4_idx].user = (flags & PAGE_USER) ? 1 : 0;
-        pml4->entries[pml4_idx].frame = ((uint64_t)pdp) >> 12;
+        if (!alloc_table(&table_phys)) return;
+        set_entry(&pml4->entries[pml4_idx], table_phys, table_flags);
     }
 
     // Get PDP
-    page_table_t* pdp = (page_table_t*)(pml4->entries[pml4_idx].frame << 12);
+    page_table_t* pdp = entry_table(&pml4->entries[pml4_idx]);
 
     // Ensure PDP entry exists
     if (!pdp->entries[pdp_idx].present) {
-        page_table_t* pd = (page_table_t*)alloc_page();
-        memset(pd, 0, sizeof(page_table_t));
-        
-        pdp->entries[pdp_idx].present = 1;
-        pdp->entries[pdp_idx].rw = 1;
-        pdp->entries[pdp_idx].user = (flags & PAGE_USER) ? 1 : 0;
-        pdp->entries[pdp_idx].frame = ((uint64_t)pd) >> 12;
+        if (!alloc_table(&table_phys)) return;
+        set_entry(&pdp->entries[pdp_idx], table_phys, table_flags);
+    }
+    if (entry_is_huge(&pdp->entries[pdp_idx])) {
+        kprintf("PAGING: map_page(0x%llx) inside a 1GB page\n", virtual_addr);
+        return;
     }
 
     // Get PD
-    page_table_t* pd = (page_table_t*)(pdp->entries[pdp_idx].frame << 12);
+    page_table_t* pd = entry_table(&pdp->entries[pdp_idx]);
 
     // Ensure PD entry exists
     if (!pd->entries[pd_idx].present) {
-        page_table_t* pt = (page_table_t*)alloc_page();
-        memset(pt, 0, sizeof(page_table_t));
-        
-        pd->entries[pd_idx].present = 1;
-        pd->entries[pd_idx].rw = 1;
-        pd->entries[pd_idx].user = (flags & PAGE_USER) ? 1 : 0;
-        pd->entries[pd_idx].frame = ((uint64_t)pt) >> 12;
+        if (!alloc_table(&table_phys)) return;
+        set_entry(&pd->entries[pd_idx], table_phys, table_flags);
+    }
+    if (entry_is_huge(&pd->entries[pd_idx])) {
+        kprintf("PAGING: map_page(0x%llx) inside a 2MB page\n", virtual_addr);
+        return;
     }
 
     // Get PT and set final mapping
-    page_table_t* pt = (page_table_t*)(pd->entries[pd_idx].frame << 12);
+    page_table_t* pt = entry_table(&pd->entries[pd_idx]);
     
     pt->entries[pt_idx].present = 1;
     pt->entries[pt_idx].rw = (flags & PAGE_WRITABLE) ? 1 : 0;
     pt->entries[pt_idx].user = (flags & PAGE_USER) ? 1 : 0;
+    pt->entries[pt_idx].global = global_flag(pml4, flags) ? 1 : 0;
     pt->entries[pt_idx].frame = physical_addr >> 12;
 
     invlpg(virtual_addr);
 }
 
 void unmap_page(page_directory_t* pml4, uint64_t virtual_addr) {
-    (void)pml4;
+    if (!pml4) pml4 = kernel_page_dir;
+
     uint64_t pt_idx = PT_INDEX(virtual_addr);
     uint64_t pd_idx = PD_INDEX(virtual_addr);
     uint64_t pdp_idx = PDP_INDEX(virtual_addr);
     uint64_t pml4_idx = PML4_INDEX(virtual_addr);
 
-    if (!kernel_page_dir->entries[pml4_idx].present) return;
+    if (!pml4->entries[pml4_idx].present) return;
     
-    page_table_t* pdp = (page_table_t*)(kernel_page_dir->entries[pml4_idx].frame << 12);
-    if (!pdp->entries[pdp_idx].present) return;
+    page_table_t* pdp = entry_table(&pml4->entries[pml4_idx]);
+    if (!pdp->entries[pdp_idx].present || entry_is_huge(&pdp->entries[pdp_idx])) return;
     
-    page_table_t* pd = (page_table_t*)(pdp->entries[pdp_idx].frame << 12);
-    if (!pd->entries[pd_idx].present) return;
+    page_table_t* pd = entry_table(&pdp->entries[pdp_idx]);
+    if (!pd->entries[pd_idx].present || entry_is_huge(&pd->entries[pd_idx])) return;
     
-    page_table_t* pt = (page_table_t*)(pd->entries[pd_idx].frame << 12);
+    page_table_t* pt = entry_table(&pd->entries[pd_idx]);
     pt->entries[pt_idx].present = 0;
     
     invlpg(virtual_addr);
 }
 
-page_directory_t* get_kernel_page_dir(void) {
-    return kernel_page_dir;
+// ---------------------------------------------------------------
+// Range operations
+// ---------------------------------------------------------------
+
+// PD table covering virtual_addr. Missing levels are created when `create`
+// is set; NULL if a level is missing or a 1GB page covers the address.
+static page_table_t* walk_to_pd(page_directory_t* pml4, uint64_t virtual_addr,
+                                uint64_t table_flags, int create) {
+    uint64_t table_phys;
+
+    page_table_entry_t* pml4e = &pml4->entries[PML4_INDEX(virtual_addr)];
+    if (!pml4e->present) {
+        if (!create || !alloc_table(&table_phys)) return NULL;
+        set_entry(pml4e, table_phys, table_flags);
+    }
+
+    page_table_entry_t* pdpe = &entry_table(pml4e)->entries[PDP_INDEX(virtual_addr)];
+    if (!pdpe->present) {
+        if (!create || !alloc_table(&table_phys)) return NULL;
+        set_entry(pdpe, table_phys, table_flags);
+    }
+    if (entry_is_huge(pdpe)) return NULL;
+
+    return entry_table(pdpe);
 }
 
-// Allocate a free region node from the pool
-static free_region_t* alloc_free_region_node(void) {
-    if (free_region_pool_used >= MAX_FREE_REGIONS) {
-        kprintf("WARNING: Free region pool exhausted!\n");
-        return NULL;
+// Put a 2MB entry in `pde`. A page table left behind by earlier 4KB
+// mappings is released if nothing in it is mapped any more.
+static int install_huge(page_table_entry_t* pde, uint64_t physical_addr, uint64_t leaf_flags) {
+    if (pde->present) {
+        if (entry_is_huge(pde)) return -1;
+
+        page_table_t* pt = entry_table(pde);
+        for (uint32_t i = 0; i < 512; i++) {
+            if (pt->entries[i].present) return -1;
+        }
+        free_page((void*)(uintptr_t)(pde->frame << 12));
     }
-    return &free_region_pool[free_region_pool_used++];
+
+    set_entry(pde, physical_addr, leaf_flags | PAGE_HUGE);
+    huge_mappings++;
+    return 0;
 }
 
-void* kmalloc_virtual(size_t size) {
-    uint64_t pages_needed = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-    uint64_t total_size = pages_needed * PAGE_SIZE;
+// Flush the TLB. Global kernel entries need a CR4.PGE toggle, which also
+// drops the entries of every PCID; a CR3 load only clears the current one.
+static void tlb_flush_all(int global) {
+    if (global && pge_enabled) {
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        load_cr3(read_cr3());
+    }
+    tlb_full_flushes++;
+}
 
-    kprintf("KMALLOC_VIRTUAL: Allocating %lld bytes (%lld pages)\n", (uint64_t)size, pages_needed);
-    
-    // Try to find space in free list first
-    free_region_t** current = &free_list;
-    while (*current) {
-        if ((*current)->size >= total_size) {
-            uint64_t virtual_start = (*current)->start;
-
-            // Remove from free list or shrink
-            if ((*current)->size == total_size) {
-                *current = (*current)->next;
+// Frames released by unmap_range(), kept as contiguous runs so each run
+// goes back to the PMM in one call, after the TLB flush
+#define FRAME_RUNS_MAX 16
+
+typedef struct {
+    uint64_t start[FRAME_RUNS_MAX];
+    uint64_t pages[FRAME_RUNS_MAX];
+    uint32_t count;
+    int flush_all;              // TLB still holds the unmapped entries
+    int global;                 // ... and some of them are global
+} frame_batch_t;
+
+static void frame_batch_release(frame_batch_t* batch) {
+    if (batch->flush_all && batch->count) {
+        tlb_flush_all(batch->global);
+    }
+    for (uint32_t i = 0; i < batch->count; i++) {
+        free_pages((void*)(uintptr_t)batch->start[i], (uint32_t)batch->pages[i]);
+    }
+    batch->count = 0;
+}
+
+static void frame_batch_add(frame_batch_t* batch, uint64_t physical, uint64_t pages) {
+    if (batch->count) {
+        uint32_t last = batch->count - 1;
+        if (batch->start[last] + batch->pages[last] * PAGE_SIZE == physical) {
+            batch->pages[last] += pages;
+            return;
+        }
+    }
+    if (batch->count == FRAME_RUNS_MAX) {
+        frame_batch_release(batch);
+    }
+    batch->start[batch->count] = physical;
+    batch->pages[batch->count] = pages;
+    batch->count++;
+}
+
+// Drop the mapping's reference on each frame; frames nobody else holds
+// join the batch
+static void frame_batch_put(frame_batch_t* batch, uint64_t physical, uint64_t pages) {
+    for (uint64_t i = 0; i < pages; i++) {
+        uint64_t frame = physical + i * PAGE_SIZE;
+        if (page_ref_dec(frame) == 0) {
+            frame_batch_add(batch, frame, 1);
+        }
+    }
+}
+
+int map_range(page_directory_t* pml4, uint64_t virtual_addr, uint64_t physical_addr,
+              uint64_t length, uint64_t flags) {
+    if (!pml4) pml4 = kernel_page_dir;
+
+    uint64_t va = virtual_addr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t pa = physical_addr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = ALIGN_UP(virtual_addr + length, PAGE_SIZE);
+    uint64_t table_flags = PAGE_PRESENT | PAGE_WRITABLE | (flags & PAGE_USER);
+    uint64_t leaf_flags = PAGE_PRESENT | global_flag(pml4, flags) |
+        (flags & (PAGE_WRITABLE | PAGE_USER | PAGE_WRITETHROUGH | PAGE_CACHE_DISABLE |
+                  PAGE_RECLAIM));
+    int flush_all = (end - va) / PAGE_SIZE > PAGING_FLUSH_THRESHOLD;
+    int result = 0;
+
+    // Demand-zero entries carry no frame and are filled one 4KB page at a
+    // time by the fault handler
+    int lazy = (flags & PAGE_LAZY) != 0;
+    if (lazy) {
+        leaf_flags = (leaf_flags & ~PAGE_PRESENT) | PAGE_LAZY;
+        flags &= ~PAGE_HUGE;
+        pa = 0;
+    }
+
+    while (va < end) {
+        // One upper-level walk per PD entry (512 PTEs or one 2MB page)
+        page_table_t* pd = walk_to_pd(pml4, va, table_flags, 1);
+        if (!pd) {
+            kprintf("PAGING: map_range(0x%llx) failed at the PDP level\n", va);
+            result = -1;
+            break;
+        }
+
+        page_table_entry_t* pde = &pd->entries[PD_INDEX(va)];
+        uint64_t limit = ALIGN_UP(va + 1, PAGE_SIZE_2M);
+        if (limit > end) limit = end;
+
+        if ((flags & PAGE_HUGE) && ((va | pa) & (PAGE_SIZE_2M - 1)) == 0 &&
+            end - va >= PAGE_SIZE_2M && install_huge(pde, pa, leaf_flags) == 0) {
+            if (!flush_all) invlpg(va);
+            va += PAGE_SIZE_2M;
+            pa += PAGE_SIZE_2M;
+            continue;
+        }
+
+        if (!pde->present) {
+            uint64_t table_phys;
+            if (!alloc_table(&table_phys)) {
+                result = -1;
+                break;
+            }
+            set_entry(pde, table_phys, table_flags);
+        } else if (entry_is_huge(pde)) {
+            kprintf("PAGING: map_range(0x%llx) inside a 2MB page\n", va);
+            result = -1;
+            pa += limit - va;
+            va = limit;
+            continue;
+        }
+
+        page_table_t* pt = entry_table(pde);
+        if (lazy) {
+            for (; va < limit; va += PAGE_SIZE) {
+                set_entry(&pt->entries[PT_INDEX(va)], 0, leaf_flags);
+                lazy_pending++;
+            }
+            continue;
+        }
+        for (; va < limit; va += PAGE_SIZE, pa += PAGE_SIZE) {
+            set_entry(&pt->entries[PT_INDEX(va)], pa, leaf_flags);
+            if (!flush_all) invlpg(va);
+        }
+    }
+
+    if (flush_all) tlb_flush_all(pml4 == kernel_page_dir);
+    return result;
+}
+
+void unmap_range(page_directory_t* pml4, uint64_t virtual_addr, uint64_t length, int free_frames) {
+    if (!pml4) pml4 = kernel_page_dir;
+
+    uint64_t va = virtual_addr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = ALIGN_UP(virtual_addr + length, PAGE_SIZE);
+
+    frame_batch_t batch;
+    batch.count = 0;
+    batch.flush_all = (end - va) / PAGE_SIZE > PAGING_FLUSH_THRESHOLD;
+    batch.global = (pml4 == kernel_page_dir);
+
+    // An address space that is not loaded may still have entries cached
+    // under its PCID; invlpg cannot reach them
+    if (pcid_enabled && pml4 != current_directory && pml4 != kernel_page_dir) {
+        pcid_generation++;
+    }
+
+    while (va < end) {
+        page_table_t* pd = walk_to_pd(pml4, va, 0, 0);
+        if (!pd) {
+            // Nothing mapped in this 1GB slot (or a physmap 1GB page)
+            va = ALIGN_UP(va + 1, PAGE_SIZE_1G);
+            continue;
+        }
+
+        page_table_entry_t* pde = &pd->entries[PD_INDEX(va)];
+        uint64_t limit = ALIGN_UP(va + 1, PAGE_SIZE_2M);
+        if (limit > end) limit = end;
+
+        if (!pde->present) {
+            va = limit;
+            continue;
+        }
+
+        if (entry_is_huge(pde)) {
+            if ((va & (PAGE_SIZE_2M - 1)) == 0 && limit - va == PAGE_SIZE_2M) {
+                if (free_frames) {
+                    frame_batch_put(&batch, pde->frame << 12, PAGE_SIZE_2M / PAGE_SIZE);
+                }
+                *(uint64_t*)pde = 0;
+                huge_mappings--;
+                if (!batch.flush_all) invlpg(va);
             } else {
-                (*current)->start += total_size;
-                (*current)->size -= total_size;
+                kprintf("PAGING: unmap_range(0x%llx) splits a 2MB page, skipped\n", va);
             }
+            va = limit;
+            continue;
+        }
 
-            // Allocate physical pages and map
-            void* physical = alloc_pages(pages_needed);
-            if (!physical) return NULL;
+        page_table_t* pt = entry_table(pde);
+        for (; va < limit; va += PAGE_SIZE) {
+            page_table_entry_t* pte = &pt->entries[PT_INDEX(va)];
+            if (!pte->present) {
+                uint64_t value = entry_value(pte);
+                if (value & PAGE_LAZY) {
+                    // Demand-zero page that was never touched
+                    lazy_pending--;
+                } else if (value & PAGE_ZRAM) {
+                    zram_drop((uint32_t)((value & ENTRY_FRAME_MASK) >> 12));
+                }
+                *(uint64_t*)pte = 0;
+                continue;
+            }
 
-            for (uint64_t i = 0; i < pages_needed; i++) {
-                uint64_t virtual_addr = virtual_start + i * PAGE_SIZE;
-                uint64_t physical_addr = (uint64_t)physical + i * PAGE_SIZE;
-                map_page(kernel_page_dir, virtual_addr, physical_addr, PAGE_WRITABLE);
+            if (free_frames) {
+                frame_batch_put(&batch, pte->frame << 12, 1);
             }
+            *(uint64_t*)pte = 0;
+            if (!batch.flush_all) invlpg(va);
+        }
+    }
+
+    // A final release with frames in it flushes; otherwise flush here
+    if (batch.flush_all && !batch.count) tlb_flush_all(batch.global);
+    frame_batch_release(&batch);
+}
+
+int map_huge_page(page_directory_t* pml4, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
+    if ((virtual_addr | physical_addr) & (PAGE_SIZE_2M - 1)) return -1;
+    if (!pml4) pml4 = kernel_page_dir;
+
+    page_table_t* pd = walk_to_pd(pml4, virtual_addr,
+                                  PAGE_PRESENT | PAGE_WRITABLE | (flags & PAGE_USER), 1);
+    if (!pd) return -1;
+
+    if (install_huge(&pd->entries[PD_INDEX(virtual_addr)], physical_addr,
+                     PAGE_PRESENT | global_flag(pml4, flags) |
+                     (flags & (PAGE_WRITABLE | PAGE_USER))) < 0) {
+        return -1;
+    }
+    invlpg(virtual_addr);
+    return 0;
+}
+
+// Free the page tables of the lower half that a process does not share
+// with the kernel. Mapped frames must already have been unmapped.
+void paging_free_user_tables(page_directory_t* pml4) {
+    if (!pml4 || pml4 == kernel_page_dir) return;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        page_table_entry_t* pml4e = &pml4->entries[i];
+        if (!pml4e->present ||
+            entry_value(pml4e) == entry_value(&kernel_page_dir->entries[i])) {
+            continue;
+        }
+
+        page_table_t* pdp = entry_table(pml4e);
+        for (uint32_t j = 0; j < 512; j++) {
+            page_table_entry_t* pdpe = &pdp->entries[j];
+            if (!pdpe->present || entry_is_huge(pdpe)) continue;
+
+            page_table_t* pd = entry_table(pdpe);
+            for (uint32_t k = 0; k < 512; k++) {
+                page_table_entry_t* pde = &pd->entries[k];
+                if (pde->present && !entry_is_huge(pde)) {
+                    free_page((void*)(uintptr_t)(pde->frame << 12));
+                }
+            }
+            free_page((void*)(uintptr_t)(pdpe->frame << 12));
+        }
+        free_page((void*)(uintptr_t)(pml4e->frame << 12));
+        *(uint64_t*)pml4e = 0;
+    }
+}
+
+void paging_unmap_user(page_directory_t* pml4) {
+    if (!pml4 || pml4 == kernel_page_dir) return;
+
+    for (uint64_t i = 0; i < 256; i++) {
+        page_table_entry_t* pml4e = &pml4->entries[i];
+        if (!pml4e->present ||
+            entry_value(pml4e) == entry_value(&kernel_page_dir->entries[i])) {
+            continue;
+        }
+        // One 512GB slot; unmap_range skips absent 1GB and 2MB tables
+        unmap_range(pml4, i << 39, 1ULL << 39, 1);
+    }
+}
+
+// Duplicate one table level of a clone. Leaves (level 1) are shared:
+// writable ones become read-only COW on both sides.
+static int clone_table(page_table_t* dst, page_table_t* src, uint32_t level) {
+    for (uint32_t i = 0; i < 512; i++) {
+        page_table_entry_t* entry = &src->entries[i];
+        uint64_t value = entry_value(entry);
+        if (!(value & PAGE_PRESENT)) continue;
+
+        if (level == 1) {
+            if (value & PAGE_WRITABLE) {
+                value = (value & ~PAGE_WRITABLE) | PAGE_COW;
+                *(uint64_t*)entry = value;
+            }
+            get_page(value & ENTRY_FRAME_MASK);
+            set_entry(&dst->entries[i], value, value & ~ENTRY_FRAME_MASK);
+            continue;
+        }
+
+        if (entry_is_huge(entry)) {
+            kprintf("PAGING: Cannot clone a large user page\n");
+            return -1;
+        }
+
+        uint64_t table_phys;
+        page_table_t* table = alloc_table(&table_phys);
+        if (!table) return -1;
+        set_entry(&dst->entries[i], table_phys, value & ~ENTRY_FRAME_MASK);
+
+        if (clone_table(table, entry_table(entry), level - 1) < 0) return -1;
+    }
+    return 0;
+}
+
+int paging_clone_user(page_directory_t* dst, page_directory_t* src) {
+    if (!dst || !src || dst == kernel_page_dir || src == kernel_page_dir) return -1;
+
+    int result = 0;
+    for (uint32_t i = 0; i < 256 && result == 0; i++) {
+        page_table_entry_t* pml4e = &src->entries[i];
+        if (!pml4e->present ||
+            entry_value(pml4e) == entry_value(&kernel_page_dir->entries[i])) {
+            continue;
+        }
+
+        uint64_t table_phys;
+        page_table_t* pdp = alloc_table(&table_phys);
+        if (!pdp) {
+            result = -1;
+            break;
+        }
+        set_entry(&dst->entries[i], table_phys, entry_value(pml4e) & ~ENTRY_FRAME_MASK);
+        result = clone_table(pdp, entry_table(pml4e), 3);
+    }
+
+    // src lost write access to its pages
+    if (src == current_directory) {
+        tlb_flush_all(0);
+    } else if (pcid_enabled) {
+        pcid_generation++;
+    }
+    return result;
+}
+
+uint32_t paging_get_tlb_full_flushes(void) {
+    return tlb_full_flushes;
+}
+
+uint32_t paging_get_huge_count(void) {
+    return huge_mappings;
+}
+
+page_directory_t* get_kernel_page_dir(void) {
+    return kernel_page_dir;
+}
+
+static void reclaim_add(uint64_t start, uint64_t size) {
+    for (uint32_t i = 0; i < RECLAIM_MAX_RANGES; i++) {
+        if (reclaim_ranges[i].end) continue;
+        reclaim_ranges[i].start = start;
+        reclaim_ranges[i].end = start + size;
+        reclaim_ranges[i].hand = start;
+        return;
+    }
+    kprintf("PAGING: No reclaim slot for 0x%llx, range stays resident\n", start);
+}
 
-            return (void*)virtual_start;
+static void reclaim_remove(uint64_t start) {
+    for (uint32_t i = 0; i < RECLAIM_MAX_RANGES; i++) {
+        if (reclaim_ranges[i].end && reclaim_ranges[i].start == start) {
+            reclaim_ranges[i].start = reclaim_ranges[i].end = 0;
         }
-        current = &(*current)->next;
     }
+}
 
-    // No suitable free region, allocate from heap end
-    if (kernel_heap_next + total_size > KERNEL_HEAP_END) {
+void* kmalloc_virtual(size_t size) {
+    return kmalloc_virtual_flags(size, 0);
+}
+
+// Reserve-only allocation: address space and page tables, no frames
+static void* kmalloc_virtual_lazy(uint64_t total_size, int reclaim) {
+    uint64_t virtual_start = vmem_alloc(&kernel_vmem, total_size, PAGE_SIZE);
+    if (!virtual_start) {
         kprintf("KMALLOC: Out of kernel heap space!\n");
         return NULL;
     }
 
-    void* physical = alloc_pages(pages_needed);
+    if (map_range(kernel_page_dir, virtual_start, 0, total_size,
+                  PAGE_WRITABLE | PAGE_LAZY | (reclaim ? PAGE_RECLAIM : 0)) < 0) {
+        unmap_range(kernel_page_dir, virtual_start, total_size, 0);
+        vmem_free(&kernel_vmem, virtual_start);
+        return NULL;
+    }
+
+    kprintf("KMALLOC_VIRTUAL: Reserved 0x%llx (%lld KB demand-zero)\n",
+            virtual_start, total_size / 1024);
+    return (void*)virtual_start;
+}
+
+void* kmalloc_virtual_flags(size_t size, uint32_t flags) {
+    uint64_t pages_needed = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t total_size = pages_needed * PAGE_SIZE;
+
+    if (flags & KV_LAZY) {
+        if (!kernel_vmem_ready) kernel_heap_init();
+        void* lazy = kmalloc_virtual_lazy(total_size, (flags & KV_RECLAIM) != 0);
+        if (lazy && (flags & KV_RECLAIM)) reclaim_add((uint64_t)lazy, total_size);
+        return lazy;
+    }
+
+    // Requests of 2MB and up get a 2MB-aligned virtual range. Their
+    // physical run is a buddy block of order >= 9, so it is aligned too.
+    uint64_t align = (total_size >= PAGE_SIZE_2M) ? PAGE_SIZE_2M : PAGE_SIZE;
+
+    kprintf("KMALLOC_VIRTUAL: Allocating %lld bytes (%lld pages)\n", (uint64_t)size, pages_needed);
+
+    void* physical = alloc_pages((uint32_t)pages_needed);
     if (!physical) {
         kprintf("KMALLOC: Out of physical memory!\n");
         return NULL;
     }
 
-    for (uint64_t i = 0; i < pages_needed; i++) {
-        uint64_t virtual_addr = kernel_heap_next + i * PAGE_SIZE;
-        uint64_t physical_addr = (uint64_t)physical + i * PAGE_SIZE;
-        map_page(kernel_page_dir, virtual_addr, physical_addr, PAGE_WRITABLE);
+    if (!kernel_vmem_ready) kernel_heap_init();
+
+    uint64_t virtual_start = vmem_alloc(&kernel_vmem, total_size, align);
+    if (!virtual_start) {
+        kprintf("KMALLOC: Out of kernel heap space!\n");
+        free_pages(physical, (uint32_t)pages_needed);
+        return NULL;
     }
-    
-    void* result = (void*)kernel_heap_next;
-    kernel_heap_next += total_size;
-    
-    kprintf("KMALLOC_VIRTUAL: Returning 0x%llx\n", (uint64_t)result);
 
-    return result;
+    // 2MB entries wherever both sides line up, one walk per table.
+    // Reclaimable ranges stay 4KB so single pages can be evicted.
+    uint64_t map_flags = (flags & KV_RECLAIM) ? PAGE_WRITABLE | PAGE_RECLAIM
+                                              : PAGE_WRITABLE | PAGE_HUGE;
+    if (map_range(kernel_page_dir, virtual_start, (uint64_t)(uintptr_t)physical, total_size,
+                  map_flags) < 0) {
+        unmap_range(kernel_page_dir, virtual_start, total_size, 0);
+        vmem_free(&kernel_vmem, virtual_start);
+        free_pages(physical, (uint32_t)pages_needed);
+        return NULL;
+    }
+
+    // Pinned frames are not kmalloc_virtual()-owned, so compaction skips them
+    page_set_owner((uint64_t)(uintptr_t)physical, (uint32_t)pages_needed,
+                   (flags & KV_PINNED) ? PAGE_OWNER_KERNEL : PAGE_OWNER_VMALLOC);
+    if (flags & KV_RECLAIM) reclaim_add(virtual_start, total_size);
+    kprintf("KMALLOC_VIRTUAL: Returning 0x%llx\n", virtual_start);
+
+    return (void*)virtual_start;
 }
 
 void kfree_virtual(void* ptr, size_t size) {
     if (!ptr) return;
 
-    uint64_t pages_freed = (size + PAGE_SIZE - 1) / PAGE_SIZE;
     uint64_t virtual_start = (uint64_t)ptr;
-
-    // Free physical pages FIRST, then unmap
-    for (uint64_t i = 0; i < pages_freed; i++) {
-        uint64_t virtual_addr = virtual_start + i * PAGE_SIZE;
-        uint64_t physical_addr = get_physical_address(kernel_page_dir, virtual_addr);
-
-        if (physical_addr) {
-            free_page((void*)(physical_addr & 0xFFFFFFFFFFFFF000ULL));
-        }
+    uint64_t reserved = vmem_size(&kernel_vmem, virtual_start);
+    if (!reserved) {
+        kprintf("KFREE_VIRTUAL: 0x%llx was not allocated\n", virtual_start);
+        return;
     }
-
-    // Now unmap the pages
-    for (uint64_t i = 0; i < pages_freed; i++) {
-        uint64_t virtual_addr = virtual_start + i * PAGE_SIZE;
-        unmap_page(kernel_page_dir, virtual_addr);
+    if (ALIGN_UP((uint64_t)size, PAGE_SIZE) != reserved) {
+        kprintf("KFREE_VIRTUAL: 0x%llx freed with size %lld, allocated %lld\n",
+                virtual_start, (uint64_t)size, reserved);
     }
 
-    // Add to free list
-    free_region_t* region = alloc_free_region_node();
-    if (region) {
-        region->start = virtual_start;
-        region->size = pages_freed * PAGE_SIZE;
-        region->next = free_list;
-        free_list = region;
-    }
+    // One pass: unmap, flush, then hand the frames back in runs
+    reclaim_remove(virtual_start);
+    unmap_range(kernel_page_dir, virtual_start, reserved, 1);
+
+    // The range coalesces with free neighbours
+    vmem_free(&kernel_vmem, virtual_start);
 }
 
 void* physical_to_virtual(uint64_t physical_addr, size_t size) {
@@ -363,9 +1040,121 @@ void* physical_to_virtual(uint64_t physical_addr, size_t size) {
     return (void*)virtual_addr;
 }
 
+// 4KB page table entry for an address, NULL if it has none
+static page_table_entry_t* leaf_entry(page_directory_t* pml4, uint64_t address) {
+    page_table_t* pd = walk_to_pd(pml4, address, 0, 0);
+    if (!pd) return NULL;
+
+    page_table_entry_t* pde = &pd->entries[PD_INDEX(address)];
+    if (!pde->present || entry_is_huge(pde)) return NULL;
+
+    return &entry_table(pde)->entries[PT_INDEX(address)];
+}
+
+// First touch of a KV_LAZY page: back it with a zeroed frame. Returns 0
+// if the fault is not a demand-zero fault.
+static int lazy_fault(uint64_t address, uint64_t error_code) {
+    if (error_code & 0x1) return 0;   // Protection violation, page is present
+    if (address < KERNEL_HEAP_START || address >= KERNEL_HEAP_END) return 0;
+
+    // Kernel heap tables are shared by every process page directory
+    page_table_entry_t* pte = leaf_entry(kernel_page_dir, address);
+    if (!pte) return 0;
+
+    uint64_t value = entry_value(pte);
+    if (!(value & PAGE_LAZY)) return 0;
+    if ((error_code & 0x4) && !(value & PAGE_USER)) return 0;
+
+    void* frame = alloc_page_zeroed();
+    if (!frame) {
+        kprintf("PAGING: Out of memory for demand-zero page at 0x%llx\n", address);
+        return 0;
+    }
+    page_set_owner((uint64_t)(uintptr_t)frame, 1, PAGE_OWNER_VMALLOC);
+
+    set_entry(pte, (uint64_t)(uintptr_t)frame, PAGE_PRESENT | (value & LEAF_KEEP_FLAGS));
+    invlpg(address);
+
+    lazy_faults++;
+    lazy_pending--;
+    return 1;
+}
+
+// Access to a page reclaim compressed: decompress it into a new frame.
+// Returns 0 if the fault is not a zram fault.
+static int zram_fault(uint64_t address, uint64_t error_code) {
+    if (error_code & 0x1) return 0;
+    if (address < KERNEL_HEAP_START || address >= KERNEL_HEAP_END) return 0;
+
+    page_table_entry_t* pte = leaf_entry(kernel_page_dir, address);
+    if (!pte) return 0;
+
+    uint64_t value = entry_value(pte);
+    if (!(value & PAGE_ZRAM)) return 0;
+    if ((error_code & 0x4) && !(value & PAGE_USER)) return 0;
+
+    uint64_t start = rdtsc();
+    void* frame = alloc_page();
+    if (!frame) {
+        kprintf("PAGING: Out of memory for zram page at 0x%llx\n", address);
+        return 0;
+    }
+
+    uint32_t slot = (uint32_t)((value & ENTRY_FRAME_MASK) >> 12);
+    if (zram_load(slot, phys_to_virt((uint64_t)(uintptr_t)frame)) < 0) {
+        free_page(frame);
+        return 0;
+    }
+    page_set_owner((uint64_t)(uintptr_t)frame, 1, PAGE_OWNER_VMALLOC);
+
+    set_entry(pte, (uint64_t)(uintptr_t)frame, PAGE_PRESENT | (value & LEAF_KEEP_FLAGS));
+    invlpg(address);
+
+    reclaim_stats.faults++;
+    reclaim_stats.fault_cycles += rdtsc() - start;
+    return 1;
+}
+
+// Write to a PAGE_COW page: copy the frame unless this mapping is the
+// last one holding it, then make the entry writable again. Returns 0 if
+// the fault is not a COW fault.
+static int cow_fault(uint64_t address, uint64_t error_code) {
+    if ((error_code & 0x3) != 0x3) return 0;   // Needs a write to a present page
+
+    page_directory_t* pml4 = current_directory ? current_directory : kernel_page_dir;
+    page_table_entry_t* pte = leaf_entry(pml4, address);
+    if (!pte) return 0;
+
+    uint64_t value = entry_value(pte);
+    if (!(value & PAGE_COW)) return 0;
+
+    uint64_t frame = value & ENTRY_FRAME_MASK;
+    if (page_ref_count(frame) > 1) {
+        void* copy = alloc_page();
+        if (!copy) {
+            kprintf("PAGING: Out of memory copying COW page at 0x%llx\n", address);
+            return 0;
+        }
+        memcpy(phys_to_virt((uint64_t)(uintptr_t)copy), phys_to_virt(frame), PAGE_SIZE);
+        page_set_owner((uint64_t)(uintptr_t)copy, 1, PAGE_OWNER_USER);
+        put_page(frame);
+        frame = (uint64_t)(uintptr_t)copy;
+        cow_copies++;
+    }
+
+    set_entry(pte, frame, (value & ~(ENTRY_FRAME_MASK | PAGE_COW)) | PAGE_WRITABLE);
+    invlpg(address);
+    cow_faults++;
+    return 1;
+}
+
 void page_fault_handler(uint64_t error_code) {
     uint64_t faulting_address = read_cr2();
 
+    if (lazy_fault(faulting_address, error_code)) return;
+    if (zram_fault(faulting_address, error_code)) return;
+    if (cow_fault(faulting_address, error_code)) return;
+
     kprintf("\n!!! PAGE FAULT !!!\n");
     kprintf("Faulting address: 0x%llx\n", faulting_address);
     kprintf("Error code: 0x%llx\n", error_code);
@@ -379,16 +1168,371 @@ void page_fault_handler(uint64_t error_code) {
 }
 
 void kernel_heap_init(void) {
-    kernel_heap_next = KERNEL_HEAP_START;
-    free_list = NULL;
-    free_region_pool_used = 0;
+    if (vmem_init(&kernel_vmem, "kernel_va", KERNEL_HEAP_START,
+                  KERNEL_HEAP_END - KERNEL_HEAP_START, PAGE_SIZE) < 0) {
+        kprintf("HEAP: Failed to set up kernel address space\n");
+        return;
+    }
+    kernel_vmem_ready = 1;
     kprintf("HEAP: Kernel heap initialized at 0x%llx\n", KERNEL_HEAP_START);
 }
 
+void paging_get_lazy_stats(uint64_t* faults, uint64_t* pending_pages) {
+    if (faults) *faults = lazy_faults;
+    if (pending_pages) *pending_pages = lazy_pending;
+}
+
+void paging_get_cow_stats(uint64_t* faults, uint64_t* copies) {
+    if (faults) *faults = cow_faults;
+    if (copies) *copies = cow_copies;
+}
+
+void paging_get_vmem_stats(vmem_stats_t* stats) {
+    vmem_get_stats(&kernel_vmem, stats);
+}
+
+// ---------------------------------------------------------------
+// Compaction
+// ---------------------------------------------------------------
+
+// Flag (or unflag) the movable frames: 4KB kernel-heap leaves owned by
+// kmalloc_virtual() with no other reference. While flagged, a frame's
+// lru_next holds the page it is mapped at.
+static uint32_t compact_mark(int mark) {
+    uint32_t movable = 0;
+
+    for (uint64_t va = KERNEL_HEAP_START; va < KERNEL_HEAP_END; va += PAGE_SIZE_2M) {
+        page_table_t* pd = walk_to_pd(kernel_page_dir, va, 0, 0);
+        if (!pd) continue;
+
+        page_table_entry_t* pde = &pd->entries[PD_INDEX(va)];
+        if (!pde->present || entry_is_huge(pde)) continue;
+
+        page_table_t* pt = entry_table(pde);
+        for (uint32_t i = 0; i < 512; i++) {
+            uint64_t value = entry_value(&pt->entries[i]);
+            if (!(value & PAGE_PRESENT)) continue;
+
+            page_frame_t* frame = phys_to_frame(value & ENTRY_FRAME_MASK);
+            if (!frame) continue;
+
+            if (!mark) {
+                if (frame->flags & PF_MOVABLE) {
+                    frame->flags &= ~PF_MOVABLE;
+                    frame->lru_next = PFN_NONE;
+                }
+                continue;
+            }
+
+            if (frame->owner != PAGE_OWNER_VMALLOC || frame->refcount != 1 ||
+                (frame->flags & (PF_RESERVED | PF_LRU))) {
+                continue;
+            }
+            frame->flags |= PF_MOVABLE;
+            frame->lru_next = (uint32_t)((va + (uint64_t)i * PAGE_SIZE) >> 12);
+            movable++;
+        }
+    }
+    return movable;
+}
+
+// Empty one 2MB block: isolate its free pages, copy each movable page to a
+// frame outside it and repoint the mapping. Returns 1 once the whole block
+// is back in the PMM as a single order-9 run.
+static int compact_block(uint32_t pfn) {
+    pmm_isolate_range(pfn, PMM_COMPACT_PAGES);
+
+    int complete = 1;
+    for (uint32_t i = 0; i < PMM_COMPACT_PAGES; i++) {
+        page_frame_t* frame = pfn_to_frame(pfn + i);
+        if (!(frame->flags & PF_MOVABLE)) continue;
+
+        uint64_t va = (uint64_t)frame->lru_next << 12;
+        page_table_entry_t* pte = leaf_entry(kernel_page_dir, va);
+        void* copy = alloc_page();
+        if (!pte || !copy) {
+            if (copy) free_page(copy);
+            complete = 0;
+            break;
+        }
+
+        uint64_t old = (uint64_t)(pfn + i) * PAGE_SIZE;
+        memcpy(phys_to_virt((uint64_t)(uintptr_t)copy), phys_to_virt(old), PAGE_SIZE);
+        page_set_owner((uint64_t)(uintptr_t)copy, 1, PAGE_OWNER_VMALLOC);
+
+        set_entry(pte, (uint64_t)(uintptr_t)copy, entry_value(pte) & ~ENTRY_FRAME_MASK);
+        invlpg(va);
+
+        frame->flags &= ~PF_MOVABLE;
+        frame->lru_next = PFN_NONE;
+        frame->owner = PAGE_OWNER_NONE;
+        compact_stats.pages_migrated++;
+    }
+
+    if (complete) {
+        free_pages((void*)(uintptr_t)((uint64_t)pfn * PAGE_SIZE), PMM_COMPACT_PAGES);
+        return 1;
+    }
+
+    // Out of frames: give back what was isolated or already migrated
+    for (uint32_t i = 0; i < PMM_COMPACT_PAGES; i++) {
+        if (pfn_to_frame(pfn + i)->flags & PF_MOVABLE) continue;
+        free_page((void*)(uintptr_t)((uint64_t)(pfn + i) * PAGE_SIZE));
+    }
+    return 0;
+}
+
+uint32_t paging_compact(uint32_t blocks) {
+    if (!kernel_page_dir) return 0;
+
+    compact_stats.runs++;
+    compact_stats.movable_pages = compact_mark(1);
+
+    uint32_t freed = 0;
+    while (blocks == 0 || freed < blocks) {
+        uint32_t pfn = pmm_compact_pick_block();
+        if (pfn == PFN_NONE || !compact_block(pfn)) break;
+        freed++;
+    }
+
+    compact_mark(0);
+    compact_stats.blocks_freed += freed;
+    return freed;
+}
+
+static uint32_t compact_on_failure(uint32_t blocks) {
+    compact_stats.auto_runs++;
+    return paging_compact(blocks);
+}
+
+void paging_get_compact_stats(paging_compact_stats_t* stats) {
+    if (stats) *stats = compact_stats;
+}
+
+// ---------------------------------------------------------------
+// Reclaim to zram
+// ---------------------------------------------------------------
+
+// Next page under the clock hand, moving on to the next range at the end
+// of one; 0 if no range is registered
+static uint64_t reclaim_advance(void) {
+    for (uint32_t tries = 0; tries <= RECLAIM_MAX_RANGES; tries++) {
+        reclaim_range_t* range = &reclaim_ranges[reclaim_hand_range];
+        if (range->end && reclaim_hand >= range->start && reclaim_hand < range->end) {
+            uint64_t va = reclaim_hand;
+            reclaim_hand += PAGE_SIZE;
+            return va;
+        }
+        reclaim_hand_range = (reclaim_hand_range + 1) % RECLAIM_MAX_RANGES;
+        reclaim_hand = reclaim_ranges[reclaim_hand_range].start;
+    }
+    return 0;
+}
+
+// One step of a clock hand: an accessed page gets a second chance, a
+// cold one is compressed to zram. Returns 1 if its frame was freed.
+static uint32_t reclaim_page(uint64_t va) {
+    page_table_entry_t* pte = leaf_entry(kernel_page_dir, va);
+    if (!pte) return 0;
+
+    uint64_t value = entry_value(pte);
+    if (!(value & PAGE_PRESENT)) return 0;
+    reclaim_stats.scanned++;
+
+    if (value & PAGE_ACCESSED) {
+        set_entry(pte, value, value & ~(ENTRY_FRAME_MASK | PAGE_ACCESSED));
+        invlpg(va);
+        reclaim_stats.second_chances++;
+        return 0;
+    }
+
+    uint64_t frame = value & ENTRY_FRAME_MASK;
+    if (page_ref_count(frame) != 1) return 0;
+
+    // Unmap before compressing so no write can slip in after the copy
+    set_entry(pte, 0, 0);
+    invlpg(va);
+
+    int32_t slot = zram_store(phys_to_virt(frame));
+    if (slot < 0) {
+        set_entry(pte, frame, value & ~ENTRY_FRAME_MASK);
+        return 0;
+    }
+
+    set_entry(pte, (uint64_t)slot << 12, PAGE_ZRAM | (value & LEAF_KEEP_FLAGS));
+    put_page(frame);
+    return 1;
+}
+
+uint32_t paging_reclaim(uint32_t pages) {
+    uint64_t span = 0;
+    for (uint32_t i = 0; i < RECLAIM_MAX_RANGES; i++) {
+        if (reclaim_ranges[i].end) {
+            span += (reclaim_ranges[i].end - reclaim_ranges[i].start) / PAGE_SIZE;
+        }
+    }
+    if (!span || !kernel_page_dir) return 0;
+
+    reclaim_stats.runs++;
+    uint32_t freed = 0;
+
+    // Two turns of the clock at most: the first may only clear accessed bits
+    for (uint64_t step = 0; step < 2 * span && freed < pages; step++) {
+        uint64_t va = reclaim_advance();
+        if (!va) break;
+        freed += reclaim_page(va);
+    }
+
+    reclaim_stats.pages_reclaimed += freed;
+    return freed;
+}
+
+uint32_t paging_reclaim_range(const void* start, uint32_t pages) {
+    reclaim_range_t* range = NULL;
+    for (uint32_t i = 0; i < RECLAIM_MAX_RANGES; i++) {
+        if (reclaim_ranges[i].end && reclaim_ranges[i].start == (uint64_t)(uintptr_t)start) {
+            range = &reclaim_ranges[i];
+        }
+    }
+    if (!range || !kernel_page_dir) return 0;
+
+    reclaim_stats.runs++;
+    uint64_t span = (range->end - range->start) / PAGE_SIZE;
+    uint32_t freed = 0;
+
+    for (uint64_t step = 0; step < 2 * span && freed < pages; step++) {
+        if (range->hand < range->start || range->hand >= range->end) {
+            range->hand = range->start;
+        }
+        uint64_t va = range->hand;
+        range->hand += PAGE_SIZE;
+        freed += reclaim_page(va);
+    }
+
+    reclaim_stats.pages_reclaimed += freed;
+    return freed;
+}
+
+void paging_reclaim_idle(void) {
+    if (get_free_memory() / PAGE_SIZE < RECLAIM_LOW_PAGES) {
+        paging_reclaim(RECLAIM_IDLE_BATCH);
+    }
+}
+
+void paging_get_reclaim_stats(paging_reclaim_stats_t* stats) {
+    if (stats) *stats = reclaim_stats;
+}
+
+// ---------------------------------------------------------------
+// Switch-cost benchmark
+// ---------------------------------------------------------------
+
+#define BENCH_FULL_FLUSH 0
+#define BENCH_CR3        1
+#define BENCH_PCID       2
+
+static void bench_load(page_directory_t* pml4, uint16_t pcid, int mode) {
+    if (mode == BENCH_PCID) {
+        switch_page_directory_pcid(pml4, pcid);
+        return;
+    }
+
+    load_cr3(virt_to_phys(pml4));
+    if (mode == BENCH_FULL_FLUSH && pge_enabled) {
+        // What every switch cost before kernel entries were global
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    }
+}
+
+static inline void bench_touch(volatile uint8_t* buffer, uint32_t pages) {
+    for (uint32_t i = 0; i < pages; i++) {
+        (void)buffer[(uint64_t)i * PAGE_SIZE];
+    }
+}
+
+// Private, non-global pages of the scratch space; a lower-half slot the
+// kernel directory does not use, so its tables belong to scratch alone
+#define BENCH_PRIVATE_VA 0x0000400000000000ULL
+
+static uint64_t bench_run(page_directory_t* scratch, uint16_t pcid, int mode,
+                          volatile uint8_t* buffer, uint32_t pages, uint32_t iterations) {
+    volatile uint8_t* private = (volatile uint8_t*)BENCH_PRIVATE_VA;
+
+    // Warm up so the first iteration does not pay for cold caches
+    bench_load(scratch, pcid, mode);
+    bench_touch(private, pages);
+    bench_load(kernel_page_dir, 0, mode);
+    bench_touch(buffer, pages);
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++) {
+        bench_load(scratch, pcid, mode);
+        bench_touch(private, pages);
+        bench_load(kernel_page_dir, 0, mode);
+        bench_touch(buffer, pages);
+    }
+    return (rdtsc() - start) / iterations;
+}
+
+int paging_switch_benchmark(uint32_t iterations, uint32_t pages, paging_switch_bench_t* result) {
+    if (!result || iterations == 0) return -1;
+    if (pages == 0) pages = 1;
+    if (pages > 256) pages = 256;   // Stay below 2MB so the buffer uses 4KB pages
+
+    // The scratch address space shares every kernel mapping and adds
+    // private pages of its own, like a process. Only those are lost on a
+    // plain CR3 load; the global kernel buffer survives every mode but
+    // the full flush.
+    uint64_t bytes = (uint64_t)pages * PAGE_SIZE;
+    page_directory_t* scratch = (page_directory_t*)kmalloc_virtual(sizeof(page_directory_t));
+    volatile uint8_t* buffer = (volatile uint8_t*)kmalloc_virtual(bytes);
+    void* frames = alloc_pages(pages);
+    if (scratch) memcpy(scratch, kernel_page_dir, sizeof(page_directory_t));
+    if (!scratch || !buffer || !frames ||
+        map_range(scratch, BENCH_PRIVATE_VA, (uint64_t)(uintptr_t)frames, bytes,
+                  PAGE_WRITABLE) < 0) {
+        if (scratch) {
+            unmap_range(scratch, BENCH_PRIVATE_VA, bytes, 0);
+            paging_free_user_tables(scratch);
+            kfree_virtual(scratch, sizeof(page_directory_t));
+        }
+        if (frames) free_pages(frames, pages);
+        if (buffer) kfree_virtual((void*)buffer, bytes);
+        return -1;
+    }
+
+    page_directory_t* saved_dir = current_directory;
+    uint16_t saved_pcid = current_pcid;
+    uint16_t pcid = paging_alloc_pcid();
+
+    result->iterations = iterations;
+    result->pages = pages;
+    result->full_flush = bench_run(scratch, 0, BENCH_FULL_FLUSH, buffer, pages, iterations);
+    result->cr3_reload = bench_run(scratch, 0, BENCH_CR3, buffer, pages, iterations);
+    result->pcid = 0;
+
+    // Raw CR3 loads above went through PCID 0 without the bookkeeping
+    pcid_flushed[0] = 0;
+    if (pcid) {
+        result->pcid = bench_run(scratch, pcid, BENCH_PCID, buffer, pages, iterations);
+    }
+
+    switch_page_directory_pcid(saved_dir, saved_pcid);
+    paging_free_pcid(pcid);
+    unmap_range(scratch, BENCH_PRIVATE_VA, bytes, 0);
+    paging_free_user_tables(scratch);
+    free_pages(frames, pages);
+    kfree_virtual((void*)buffer, bytes);
+    kfree_virtual(scratch, sizeof(page_directory_t));
+    return 0;
+}
+
 void paging_get_stats(uint64_t* total_virtual, uint64_t* used_virtual, 
                       uint64_t* total_physical, uint64_t* used_physical) {
     if (total_virtual) *total_virtual = KERNEL_HEAP_END - KERNEL_HEAP_START;
-    if (used_virtual) *used_virtual = kernel_heap_next - KERNEL_HEAP_START;
+    if (used_virtual) *used_virtual = kernel_vmem.in_use;
     if (total_physical) *total_physical = get_total_memory();
     if (used_physical) *used_physical = get_used_memory();
 }
@@ -1,150 +1,969 @@
-// src/kernel/physical_mm.c - MB-based version (mem_size is MB)
+// src/kernel/physical_mm.c - Zoned binary buddy allocator over the E820 map
 #include "types.h"
 #include "physical_mm.h"
+#include "memory.h"
 #include "paging.h"
 #include "serial.h"
+#include "zero_pool.h"
 
+// Used-page bitmap over every PFN below max_pfn: set = allocated,
+// reserved, or not RAM at all (E820 holes and non-usable ranges)
 static uint32_t* bitmap;
-static uint32_t total_pages;
-static uint32_t used_pages;
+static uint32_t max_pfn;
+static uint32_t total_pages;     // Usable RAM pages reported by E820
+static uint32_t used_pages;      // total_pages minus pages free in the zones
+static uint32_t reserved_pages;  // [0, reserved_pages) is never handed out
 static uint32_t bitmap_size;
 
-// Keep both forms so other code can ask for bytes safely
+// Per-order free-block bitmaps. Block b of order k covers pages
+// [b << k, (b + 1) << k); its bit is set while it is a free buddy block.
+// Three levels so a search touches a handful of words at most:
+//   leaf[w]    bit i set -> block w*64+i is free
+//   summary[s] bit i set -> leaf[s*64+i] != 0
+//   top[t]     bit i set -> summary[t*64+i] != 0
+typedef struct {
+    uint64_t* leaf;
+    uint64_t* summary;
+    uint64_t* top;
+    uint32_t  nbits;
+    uint32_t  leaf_words;
+    uint32_t  summary_words;
+    uint32_t  top_words;
+    uint32_t  hint;          // rotating next-free hint (block index)
+    uint32_t  free_blocks;
+} pmm_order_map_t;
+
+// A zone owns one buddy map per order. Block b of order k in a zone covers
+// pages base_pfn + [b << k, (b + 1) << k); base_pfn is aligned to the
+// largest block so every block is also physically aligned.
+typedef struct {
+    const char* name;
+    uint32_t base_pfn;
+    uint32_t start_pfn;         // First page in the zone
+    uint32_t end_pfn;           // One past the last page
+    uint32_t managed_pages;     // Usable pages handed to the buddy maps
+    uint32_t free_pages;
+    pmm_order_map_t order_map[PMM_MAX_ORDER + 1];
+} pmm_zone_t;
+
+static pmm_zone_t zones[PMM_ZONE_COUNT];
+
+// Usable RAM runs from E820, split at zone boundaries and sorted by address
+typedef struct {
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+    uint32_t zone;
+} pmm_region_t;
+
+#define PMM_MAX_REGIONS 64
+
+static pmm_region_t regions[PMM_MAX_REGIONS];
+static uint32_t num_regions;
+
+#define PMM_DMA_END_PFN     (0x100000ULL / PAGE_SIZE)       // 1 MB
+#define PMM_NORMAL_END_PFN  (0x100000000ULL / PAGE_SIZE)    // 4 GB
+
+#define PMM_NIL 0xFFFFFFFFu
+
+// Frame descriptor array, always reached through phys_to_virt() so it
+// works on either side of the paging switch. At 16 bytes per PFN it is
+// 16MB on a 4GB guest, so it goes above the BOOT_IDENTITY_SIZE map when
+// it can: the memory below has to hold heap_init()'s pool.
+static uint64_t frames_phys;
+static uint32_t frame_count;
+
+// Stage 1.5 identity-maps the first 1GB; anything used before
+// paging_init() has to sit below that
+#define PMM_BOOT_MAP_END_PFN (0x40000000ULL / PAGE_SIZE)
+
+// Memory-pressure hooks for failed allocations
+static uint32_t (*reclaim_handler)(uint32_t pages) = NULL;
+static uint32_t (*compact_handler)(uint32_t blocks) = NULL;
+static int under_pressure = 0;
+
+// Scan-cost accounting (bitmap words examined per allocation)
+static uint64_t scan_allocs = 0;
+static uint64_t scan_words = 0;
+
 static uint32_t memory_size_mb;
-static uint32_t memory_size_bytes;
 
 // External symbols from linker script
 extern char __bss_end;
 
-static inline void mark_page_used(uint32_t page_idx) {
-    if (page_idx >= total_pages) return;
+static inline uint32_t zone_for_pfn(uint32_t pfn) {
+    if (pfn < PMM_DMA_END_PFN) return PMM_ZONE_DMA;
+    if (pfn < PMM_NORMAL_END_PFN) return PMM_ZONE_NORMAL;
+    return PMM_ZONE_HIGH;
+}
 
-    uint32_t word = page_idx / 32;
-    uint32_t bit  = page_idx % 32;
-    uint32_t mask = (1u << bit);
+static inline void* pfn_to_addr(uint32_t pfn) {
+    return (void*)(uintptr_t)((uint64_t)pfn * PAGE_SIZE);
+}
 
-    if (!(bitmap[word] & mask)) {
-        bitmap[word] |= mask;
-        used_pages++;
+static inline page_frame_t* frame_at(uint32_t pfn) {
+    return (page_frame_t*)phys_to_virt(frames_phys) + pfn;
+}
+
+// Descriptors of a freshly allocated or freed run
+static void frames_reset(uint32_t pfn, uint32_t count, uint32_t refcount, uint32_t owner) {
+    page_frame_t* frame = frame_at(pfn);
+    for (uint32_t i = 0; i < count; i++, frame++) {
+        if (refcount == 0 && frame->refcount > 1) {
+            kprintf("PMM: Freeing frame %llx with %u references\n",
+                    (uint64_t)(pfn + i) * PAGE_SIZE, frame->refcount);
+        }
+        if (frame->flags & PF_LRU) {
+            kprintf("PMM: Freeing frame %llx still on an LRU list\n",
+                    (uint64_t)(pfn + i) * PAGE_SIZE);
+        }
+        frame->lru_next = PFN_NONE;
+        frame->lru_prev = PFN_NONE;
+        frame->refcount = refcount;
+        frame->flags = 0;
+        frame->owner = (uint8_t)owner;
+    }
+}
+
+static inline uint32_t order_pages(uint32_t order) {
+    return 1u << order;
+}
+
+// Smallest order whose block holds `count` pages
+static inline uint32_t order_for_count(uint32_t count) {
+    uint32_t order = 0;
+    while (order_pages(order) < count) order++;
+    return order;
+}
+
+// ---------------------------------------------------------------
+// Used-page bitmap helpers
+// ---------------------------------------------------------------
+
+static inline int page_is_used(uint32_t page_idx) {
+    return (bitmap[page_idx / 32] >> (page_idx % 32)) & 1u;
+}
+
+static void mark_range_used(uint32_t start, uint32_t count) {
+    uint32_t i = start;
+    uint32_t end = start + count;
+
+    while (i < end && (i % 32) != 0) {
+        bitmap[i / 32] |= (1u << (i % 32));
+        i++;
+    }
+    while (i + 32 <= end) {
+        bitmap[i / 32] = 0xFFFFFFFFu;
+        i += 32;
+    }
+    while (i < end) {
+        bitmap[i / 32] |= (1u << (i % 32));
+        i++;
+    }
+}
+
+static void mark_range_free(uint32_t start, uint32_t count) {
+    uint32_t i = start;
+    uint32_t end = start + count;
+
+    while (i < end && (i % 32) != 0) {
+        bitmap[i / 32] &= ~(1u << (i % 32));
+        i++;
+    }
+    while (i + 32 <= end) {
+        bitmap[i / 32] = 0;
+        i += 32;
+    }
+    while (i < end) {
+        bitmap[i / 32] &= ~(1u << (i % 32));
+        i++;
     }
 }
 
+// ---------------------------------------------------------------
+// Hierarchical free-block bitmap helpers
+// ---------------------------------------------------------------
+
+static inline int map_test(pmm_order_map_t* m, uint32_t b) {
+    return (m->leaf[b / 64] >> (b % 64)) & 1;
+}
+
+static void map_set(pmm_order_map_t* m, uint32_t b) {
+    uint32_t w = b / 64;
+    uint32_t s = w / 64;
+
+    m->leaf[w] |= 1ULL << (b % 64);
+    m->summary[s] |= 1ULL << (w % 64);
+    m->top[s / 64] |= 1ULL << (s % 64);
+    m->free_blocks++;
+}
+
+static void map_clear(pmm_order_map_t* m, uint32_t b) {
+    uint32_t w = b / 64;
+    uint32_t s = w / 64;
+
+    m->leaf[w] &= ~(1ULL << (b % 64));
+    if (m->leaf[w] == 0) {
+        m->summary[s] &= ~(1ULL << (w % 64));
+        if (m->summary[s] == 0) {
+            m->top[s / 64] &= ~(1ULL << (s % 64));
+        }
+    }
+    m->free_blocks--;
+}
+
+// Mask keeping bits >= `bit` of a word (bit may be 64)
+static inline uint64_t mask_from(uint32_t bit) {
+    return (bit >= 64) ? 0 : (~0ULL << bit);
+}
+
+// First free block with index >= start, or PMM_NIL
+static uint32_t map_find_from(pmm_order_map_t* m, uint32_t start) {
+    if (start >= m->nbits) return PMM_NIL;
+
+    uint32_t w = start / 64;
+    uint32_t s = w / 64;
+    uint64_t word;
+
+    // Rest of the leaf word containing start
+    scan_words++;
+    word = m->leaf[w] & mask_from(start % 64);
+    if (word) return w * 64 + __builtin_ctzll(word);
+
+    // Next non-empty leaf word within the same summary word
+    scan_words++;
+    word = m->summary[s] & mask_from((w % 64) + 1);
+    if (!word) {
+        // Next non-empty summary word via the top level
+        uint32_t t = s / 64;
+        scan_words++;
+        word = m->top[t] & mask_from((s % 64) + 1);
+        while (!word) {
+            if (++t >= m->top_words) return PMM_NIL;
+            scan_words++;
+            word = m->top[t];
+        }
+        s = t * 64 + __builtin_ctzll(word);
+        scan_words++;
+        word = m->summary[s];
+    }
+    w = s * 64 + __builtin_ctzll(word);
+    scan_words++;
+    return w * 64 + __builtin_ctzll(m->leaf[w]);
+}
+
+// Find a free block at this order starting from the rotating hint
+static uint32_t map_find(pmm_order_map_t* m) {
+    uint32_t b = map_find_from(m, m->hint);
+    if (b == PMM_NIL && m->hint != 0) {
+        b = map_find_from(m, 0);
+    }
+    return b;
+}
+
+// ---------------------------------------------------------------
+// Buddy operations (in zone-relative page indices)
+// ---------------------------------------------------------------
+
+// Take a block of exactly `order` from the zone's free maps, splitting a
+// larger block if needed. Returns the zone-relative index or PMM_NIL.
+static uint32_t buddy_alloc_block(pmm_zone_t* z, uint32_t order) {
+    uint32_t k = order;
+    while (k <= PMM_MAX_ORDER && z->order_map[k].free_blocks == 0) {
+        k++;
+    }
+    if (k > PMM_MAX_ORDER) {
+        return PMM_NIL;
+    }
+
+    scan_allocs++;
+    pmm_order_map_t* m = &z->order_map[k];
+    uint32_t b = map_find(m);
+    if (b == PMM_NIL) {
+        return PMM_NIL;
+    }
+    map_clear(m, b);
+    m->hint = b + 1;
+
+    uint32_t page_idx = b << k;
+
+    // Split: keep the lower half, hand the upper half back
+    while (k > order) {
+        k--;
+        map_set(&z->order_map[k], (page_idx >> k) + 1);
+    }
+
+    z->free_pages -= order_pages(order);
+    return page_idx;
+}
+
+// Take one specific free page out of the free maps. The free block that
+// holds it is split and every other piece goes back.
+static void buddy_claim_page(pmm_zone_t* z, uint32_t page_idx) {
+    for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++) {
+        pmm_order_map_t* m = &z->order_map[k];
+        uint32_t b = page_idx >> k;
+        if (b >= m->nbits || !map_test(m, b)) continue;
+
+        map_clear(m, b);
+        while (k > 0) {
+            k--;
+            map_set(&z->order_map[k], (page_idx >> k) ^ 1);
+        }
+        z->free_pages--;
+        return;
+    }
+}
+
+// Return a block to the zone's free maps, merging with free buddies
+static void buddy_free_block(pmm_zone_t* z, uint32_t page_idx, uint32_t order) {
+    uint32_t b = page_idx >> order;
+
+    z->free_pages += order_pages(order);
+    while (order < PMM_MAX_ORDER) {
+        pmm_order_map_t* m = &z->order_map[order];
+        uint32_t buddy = b ^ 1;
+        if (buddy >= m->nbits || !map_test(m, buddy)) break;
+
+        map_clear(m, buddy);
+        b >>= 1;
+        order++;
+    }
+    map_set(&z->order_map[order], b);
+}
+
+// Carve [start, end) into the largest naturally aligned blocks
+static void buddy_free_range(pmm_zone_t* z, uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 &&
+               ((start & (order_pages(order) - 1)) != 0 ||
+                start + order_pages(order) > end)) {
+            order--;
+        }
+        buddy_free_block(z, start, order);
+        start += order_pages(order);
+    }
+}
+
+// Lay out the zone's per-order maps starting at `base`; returns the end address
+static uintptr_t order_maps_layout(pmm_zone_t* z, uintptr_t base) {
+    uint64_t* p = (uint64_t*)ALIGN_UP(base, 8);
+    uint32_t span = z->end_pfn - z->base_pfn;
+
+    for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++) {
+        pmm_order_map_t* m = &z->order_map[k];
+        m->nbits = span >> k;
+        m->leaf_words = (m->nbits + 63) / 64;
+        if (m->leaf_words == 0) m->leaf_words = 1;
+        m->summary_words = (m->leaf_words + 63) / 64;
+        m->top_words = (m->summary_words + 63) / 64;
+        m->hint = 0;
+        m->free_blocks = 0;
+
+        m->leaf = p;        p += m->leaf_words;
+        m->summary = p;     p += m->summary_words;
+        m->top = p;         p += m->top_words;
+    }
+
+    return (uintptr_t)p;
+}
+
+// ---------------------------------------------------------------
+// Initialization
+// ---------------------------------------------------------------
+
+// Page range of an E820 entry, clamped to the PFN space. Usable ranges
+// round inwards, everything else rounds outwards.
+static int e820_pfn_range(const e820_entry_t* e, int usable,
+                          uint32_t* start, uint32_t* end) {
+    uint64_t base = e->base;
+    uint64_t limit = e->base + e->length;
+    if (limit < base) limit = ~0ULL;   // Wrapped
+
+    uint64_t s = usable ? (base + PAGE_SIZE - 1) / PAGE_SIZE : base / PAGE_SIZE;
+    uint64_t t = usable ? limit / PAGE_SIZE : (limit + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (t > PMM_MAX_PFN) t = PMM_MAX_PFN;
+    if (s >= t) return 0;
+
+    *start = (uint32_t)s;
+    *end = (uint32_t)t;
+    return 1;
+}
+
+static void region_add(uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t zone = zone_for_pfn(start);
+        uint32_t limit = end;
+        if (zone == PMM_ZONE_DMA && limit > PMM_DMA_END_PFN) {
+            limit = PMM_DMA_END_PFN;
+        } else if (zone == PMM_ZONE_NORMAL && limit > PMM_NORMAL_END_PFN) {
+            limit = PMM_NORMAL_END_PFN;
+        }
+
+        if (num_regions == PMM_MAX_REGIONS) {
+            kprintf("PMM: Too many memory regions, ignoring %llx+\n",
+                    (uint64_t)start * PAGE_SIZE);
+            return;
+        }
+        regions[num_regions].start_pfn = start;
+        regions[num_regions].end_pfn = limit;
+        regions[num_regions].zone = zone;
+        num_regions++;
+        start = limit;
+    }
+}
+
+// Usable runs are read back from the bitmap, so overlapping or unsorted
+// E820 entries come out merged and in order
+static void regions_build(void) {
+    num_regions = 0;
+
+    uint32_t pfn = 0;
+    while (pfn < max_pfn) {
+        if (bitmap[pfn / 32] == 0xFFFFFFFFu && (pfn % 32) == 0) {
+            pfn += 32;
+            continue;
+        }
+        if (page_is_used(pfn)) {
+            pfn++;
+            continue;
+        }
+
+        uint32_t start = pfn;
+        while (pfn < max_pfn && !page_is_used(pfn)) pfn++;
+        region_add(start, pfn);
+    }
+}
+
+static const pmm_region_t* region_find(uint32_t pfn) {
+    uint32_t lo = 0, hi = num_regions;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (pfn < regions[mid].start_pfn) {
+            hi = mid;
+        } else if (pfn >= regions[mid].end_pfn) {
+            lo = mid + 1;
+        } else {
+            return &regions[mid];
+        }
+    }
+    return NULL;
+}
+
+// Hand the free pages of every region to its zone
+static void zones_populate(void) {
+    for (uint32_t r = 0; r < num_regions; r++) {
+        pmm_zone_t* z = &zones[regions[r].zone];
+        uint32_t pfn = regions[r].start_pfn;
+        uint32_t end = regions[r].end_pfn;
+
+        z->managed_pages += end - pfn;
+        while (pfn < end) {
+            if (page_is_used(pfn)) {
+                pfn++;
+                continue;
+            }
+            uint32_t start = pfn;
+            while (pfn < end && !page_is_used(pfn)) pfn++;
+            buddy_free_range(z, start - z->base_pfn, pfn - z->base_pfn);
+        }
+    }
+}
+
+// First usable run of `pages` frames between the post-paging identity map
+// and the end of the boot map; 0 if there is none
+static uint32_t frames_place(const e820_entry_t* e820, uint32_t e820_count, uint32_t pages) {
+    for (uint32_t i = 0; i < e820_count; i++) {
+        uint32_t start, end;
+        if (e820[i].type != E820_TYPE_USABLE || !e820_pfn_range(&e820[i], 1, &start, &end)) {
+            continue;
+        }
+        if (start < BOOT_IDENTITY_SIZE / PAGE_SIZE) start = BOOT_IDENTITY_SIZE / PAGE_SIZE;
+        if (end > PMM_BOOT_MAP_END_PFN) end = PMM_BOOT_MAP_END_PFN;
+        if (start < end && end - start >= pages) return start;
+    }
+    return 0;
+}
+
 void physical_mm_init(uint32_t mem_mb) {
     memory_size_mb = mem_mb;
-    memory_size_bytes = mem_mb * 1024u * 1024u;
 
-    // 1 MB = 256 pages of 4KB
-    total_pages = mem_mb * 256u;
-    bitmap_size = (total_pages + 31u) / 32u;
+    uint32_t e820_count;
+    const e820_entry_t* e820 = memory_get_e820(&e820_count);
 
-    kprintf("PMM: Init start (mem=%u MB, pages=%u, bitmap_words=%u)\n",
-            mem_mb, total_pages, bitmap_size);
+    // Fallback when the bootloader left no map: one region of mem_mb
+    e820_entry_t fallback = { 0, (uint64_t)mem_mb * 1024 * 1024, E820_TYPE_USABLE, 1 };
+    if (e820_count == 0) {
+        kprintf("PMM: No E820 map, assuming %u MB from 0\n", mem_mb);
+        e820 = &fallback;
+        e820_count = 1;
+    }
 
-    // Place bitmap AFTER kernel end
-    uint32_t kernel_end = (uint32_t)(uintptr_t)&__bss_end;
-    kernel_end = (kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    // PFN space ends at the highest usable page
+    max_pfn = 0;
+    for (uint32_t i = 0; i < e820_count; i++) {
+        uint32_t start, end;
+        if (e820[i].type == E820_TYPE_USABLE && e820_pfn_range(&e820[i], 1, &start, &end)) {
+            if (end > max_pfn) max_pfn = end;
+        }
+    }
+    bitmap_size = (max_pfn + 31u) / 32u;
+
+    kprintf("PMM: Init start (max_pfn=%u, top=%llx, bitmap_words=%u)\n",
+            max_pfn, (uint64_t)max_pfn * PAGE_SIZE, bitmap_size);
+
+    // Zone spans; HIGH is empty when nothing lives above 4 GB
+    static const char* zone_names[PMM_ZONE_COUNT] = { "DMA", "Normal", "High" };
+    uint32_t bounds[PMM_ZONE_COUNT + 1] = { 0, PMM_DMA_END_PFN, PMM_NORMAL_END_PFN, max_pfn };
+    for (uint32_t i = 0; i < PMM_ZONE_COUNT; i++) {
+        pmm_zone_t* z = &zones[i];
+        z->name = zone_names[i];
+        z->start_pfn = bounds[i] < max_pfn ? bounds[i] : max_pfn;
+        z->end_pfn = bounds[i + 1] < max_pfn ? bounds[i + 1] : max_pfn;
+        if (z->end_pfn < z->start_pfn) z->end_pfn = z->start_pfn;
+        z->base_pfn = z->start_pfn & ~(order_pages(PMM_MAX_ORDER) - 1);
+        z->managed_pages = 0;
+        z->free_pages = 0;
+    }
 
-    bitmap = (uint32_t*)(uintptr_t)kernel_end;
-    used_pages = 0;
+    // Place metadata AFTER kernel end: used bitmap, then per-zone maps
+    uintptr_t kernel_end = ALIGN_UP((uintptr_t)&__bss_end, PAGE_SIZE);
 
-    kprintf("PMM: Bitmap at %x, clearing...\n", bitmap);
+    bitmap = (uint32_t*)kernel_end;
+    uintptr_t meta_end = (uintptr_t)(bitmap + bitmap_size);
+    uint64_t* maps_start = (uint64_t*)ALIGN_UP(meta_end, 8);
+    for (uint32_t i = 0; i < PMM_ZONE_COUNT; i++) {
+        meta_end = order_maps_layout(&zones[i], meta_end);
+    }
 
-    // Clear bitmap
-    for (uint32_t i = 0; i < bitmap_size; i++) {
-        bitmap[i] = 0;
+    frame_count = max_pfn;
+    uint64_t frame_bytes = (uint64_t)frame_count * sizeof(page_frame_t);
+    uint32_t frame_pages = (uint32_t)(ALIGN_UP(frame_bytes, PAGE_SIZE) / PAGE_SIZE);
+    uint32_t frames_pfn = frames_place(e820, e820_count, frame_pages);
+    if (frames_pfn) {
+        frames_phys = (uint64_t)frames_pfn * PAGE_SIZE;
+    } else {
+        // Nothing usable above the identity map: after the buddy maps
+        frames_phys = ALIGN_UP(meta_end, sizeof(page_frame_t));
+        meta_end = (uintptr_t)(frames_phys + frame_bytes);
     }
 
-    kprintf("PMM: Bitmap cleared, marking reserved pages...\n");
+    kprintf("PMM: Bitmap at %x, buddy maps at %x, %u frame descriptors at %llx\n",
+            bitmap, maps_start, frame_count, frames_phys);
 
-    // Reserve pages that cover: kernel + bitmap storage itself
-    uint32_t bitmap_end = (uint32_t)(uintptr_t)bitmap + (bitmap_size * 4u);
-    uint32_t reserved_end = (bitmap_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-    uint32_t reserved_pages = reserved_end / PAGE_SIZE;
+    // Start with everything used and no free blocks
+    for (uint32_t i = 0; i < bitmap_size; i++) {
+        bitmap[i] = 0xFFFFFFFFu;
+    }
+    for (uint64_t* p = maps_start; p < (uint64_t*)meta_end; p++) {
+        *p = 0;
+    }
 
-    for (uint32_t i = 0; i < reserved_pages; i++) {
-        mark_page_used(i);
+    // Usable ranges first, then anything else claimed by E820 on top, so
+    // an overlap between a usable and a reserved entry stays reserved
+    for (uint32_t i = 0; i < e820_count; i++) {
+        uint32_t start, end;
+        if (e820[i].type == E820_TYPE_USABLE && e820_pfn_range(&e820[i], 1, &start, &end)) {
+            mark_range_free(start, end - start);
+        }
+    }
+    for (uint32_t i = 0; i < e820_count; i++) {
+        uint32_t start, end;
+        if (e820[i].type != E820_TYPE_USABLE && e820_pfn_range(&e820[i], 0, &start, &end)) {
+            if (start < max_pfn) {
+                if (end > max_pfn) end = max_pfn;
+                mark_range_used(start, end - start);
+            }
+        }
     }
 
-    // Reserve DMA region (0x10000 - 0xA0000)
-    uint32_t dma_start_page = 0x10000u / PAGE_SIZE;
-    uint32_t dma_end_page   = 0xA0000u / PAGE_SIZE;
+    regions_build();
+    total_pages = 0;
+    for (uint32_t r = 0; r < num_regions; r++) {
+        total_pages += regions[r].end_pfn - regions[r].start_pfn;
+    }
 
-    for (uint32_t i = dma_start_page; i < dma_end_page; i++) {
-        mark_page_used(i);
+    // Reserve pages that cover: kernel + PMM metadata itself.
+    // This also covers the DMA zone, whose usable RAM (0x10000 - 0xA0000)
+    // lies below the kernel and is handed to dma_init().
+    reserved_pages = (uint32_t)(ALIGN_UP(meta_end, PAGE_SIZE) / PAGE_SIZE);
+    if (reserved_pages > max_pfn) reserved_pages = max_pfn;
+    mark_range_used(0, reserved_pages);
+    if (frames_pfn) mark_range_used(frames_pfn, frame_pages);
+
+    zones_populate();
+
+    // Descriptors: whatever is still marked used here is never handed out
+    for (uint32_t pfn = 0; pfn < frame_count; pfn++) {
+        page_frame_t* frame = frame_at(pfn);
+        frame->lru_next = PFN_NONE;
+        frame->lru_prev = PFN_NONE;
+        frame->refcount = 0;
+        frame->flags = page_is_used(pfn) ? PF_RESERVED : 0;
+        frame->zone = (uint8_t)zone_for_pfn(pfn);
+        frame->owner = PAGE_OWNER_NONE;
     }
 
-    uint32_t free_pages = (used_pages <= total_pages) ? (total_pages - used_pages) : 0;
-    uint32_t free_mb = (free_pages * PAGE_SIZE) / (1024u * 1024u);
+    uint32_t free_pages = 0;
+    for (uint32_t i = 0; i < PMM_ZONE_COUNT; i++) {
+        free_pages += zones[i].free_pages;
+    }
+    used_pages = total_pages - free_pages;
+
+    for (uint32_t r = 0; r < num_regions; r++) {
+        kprintf("PMM: Region %llx - %llx (%s)\n",
+                (uint64_t)regions[r].start_pfn * PAGE_SIZE,
+                (uint64_t)regions[r].end_pfn * PAGE_SIZE - 1,
+                zones[regions[r].zone].name);
+    }
+    for (uint32_t i = 0; i < PMM_ZONE_COUNT; i++) {
+        kprintf("PMM: Zone %s: %u pages managed, %u free\n",
+                zones[i].name, zones[i].managed_pages, zones[i].free_pages);
+    }
 
     kprintf("PMM: Reserved DMA region (0x10000 - 0xA0000) for buffer pool\n");
     kprintf("PMM: Init complete! (reserved=%u pages, free=%u MB)\n",
-            used_pages, free_mb);
+            used_pages, free_pages / 256u);
+}
+
+// Exact-size allocation from one zone
+static void* zone_alloc(pmm_zone_t* z, uint32_t count, uint32_t order) {
+    uint32_t page_idx = buddy_alloc_block(z, order);
+    if (page_idx == PMM_NIL) return NULL;
+
+    // Give back the unused tail so a 2560-page request costs 2560 pages
+    if (order_pages(order) > count) {
+        buddy_free_range(z, page_idx + count, page_idx + order_pages(order));
+    }
+
+    uint32_t pfn = z->base_pfn + page_idx;
+    mark_range_used(pfn, count);
+    used_pages += count;
+    frames_reset(pfn, count, 1, PAGE_OWNER_KERNEL);
+    return pfn_to_addr(pfn);
+}
+
+void* alloc_pages_zone(uint32_t count, uint32_t zone) {
+    if (count == 0 || zone >= PMM_ZONE_COUNT) return NULL;
+    if (count > zones[zone].free_pages) return NULL;
+
+    uint32_t order = order_for_count(count);
+    if (order > PMM_MAX_ORDER) return NULL;
+
+    return zone_alloc(&zones[zone], count, order);
 }
 
 void* alloc_page(void) {
-    for (uint32_t i = 0; i < total_pages; i++) {
-        uint32_t word = i / 32;
-        uint32_t bit = i % 32;
+    return alloc_pages(1);
+}
 
-        if (!(bitmap[word] & (1u << bit))) {
-            bitmap[word] |= (1u << bit);
-            used_pages++;
-            return (void*)(uintptr_t)(i * PAGE_SIZE);
-        }
+static void* alloc_pages_fallback(uint32_t count) {
+    static const uint32_t fallback[PMM_ZONE_COUNT] = {
+        PMM_ZONE_NORMAL, PMM_ZONE_HIGH, PMM_ZONE_DMA
+    };
+
+    for (uint32_t i = 0; i < PMM_ZONE_COUNT; i++) {
+        void* page = alloc_pages_zone(count, fallback[i]);
+        if (page) return page;
     }
     return NULL;
 }
 
+// Prefer memory below 4 GB, then above it. The DMA zone is last resort.
+// A failed request is retried after emptying the zeroed page pool, then
+// after reclaim, and a large one after compaction. The handlers' own
+// allocations never recurse into them.
 void* alloc_pages(uint32_t count) {
-    if (count == 0) return NULL;
-    if (count == 1) return alloc_page();
+    void* page = alloc_pages_fallback(count);
+    if (page || under_pressure) return page;
 
-    if (count > total_pages) return NULL;
+    under_pressure = 1;
+    if (zero_pool_drain()) {
+        page = alloc_pages_fallback(count);
+    }
+    if (!page && reclaim_handler && reclaim_handler(count)) {
+        page = alloc_pages_fallback(count);
+    }
+    if (!page && count >= PMM_COMPACT_PAGES && compact_handler) {
+        kprintf("PMM: %u-page allocation failed, compacting\n", count);
+        compact_handler((count + PMM_COMPACT_PAGES - 1) / PMM_COMPACT_PAGES);
+        page = alloc_pages_fallback(count);
+    }
+    under_pressure = 0;
+    return page;
+}
 
-    for (uint32_t i = 0; i <= total_pages - count; i++) {
-        uint32_t consecutive_free = 0;
+void free_page(void* page) {
+    uint64_t pfn64 = (uint64_t)(uintptr_t)page / PAGE_SIZE;
+    if (pfn64 >= max_pfn) return;
+
+    uint32_t pfn = (uint32_t)pfn64;
+    if (pfn < reserved_pages) return;
 
-        for (uint32_t j = 0; j < count; j++) {
-            uint32_t page_idx = i + j;
-            uint32_t word = page_idx / 32;
-            uint32_t bit  = page_idx % 32;
+    const pmm_region_t* region = region_find(pfn);
+    if (!region) {
+        kprintf("PMM: free_page(%llx) outside usable RAM\n", (uint64_t)(uintptr_t)page);
+        return;
+    }
 
-            if (bitmap[word] & (1u << bit)) break;
-            consecutive_free++;
+    if (page_is_used(pfn)) {
+        pmm_zone_t* z = &zones[region->zone];
+        bitmap[pfn / 32] &= ~(1u << (pfn % 32));
+        used_pages--;
+        frames_reset(pfn, 1, 0, PAGE_OWNER_NONE);
+        buddy_free_block(z, pfn - z->base_pfn, 0);
+    }
+}
+
+// Free a contiguous run in one pass: each used sub-run is cleared in the
+// bitmap with word writes and carved straight into buddy blocks
+void free_pages(void* base, uint32_t count) {
+    uint64_t pfn64 = (uint64_t)(uintptr_t)base / PAGE_SIZE;
+    if (count == 0 || pfn64 >= max_pfn) return;
+
+    uint32_t pfn = (uint32_t)pfn64;
+    uint32_t end = (pfn64 + count > max_pfn) ? max_pfn : pfn + count;
+
+    while (pfn < end) {
+        const pmm_region_t* region = region_find(pfn);
+        if (!region || pfn < reserved_pages) {
+            free_page(pfn_to_addr(pfn));   // Reports or ignores it
+            pfn++;
+            continue;
         }
 
-        if (consecutive_free == count) {
-            for (uint32_t j = 0; j < count; j++) {
-                uint32_t page_idx = i + j;
-                uint32_t word = page_idx / 32;
-                uint32_t bit  = page_idx % 32;
+        pmm_zone_t* z = &zones[region->zone];
+        uint32_t limit = (end < region->end_pfn) ? end : region->end_pfn;
 
-                bitmap[word] |= (1u << bit);
-                used_pages++;
+        while (pfn < limit) {
+            if (!page_is_used(pfn)) {
+                pfn++;
+                continue;
             }
-            return (void*)(uintptr_t)(i * PAGE_SIZE);
+            uint32_t start = pfn;
+            while (pfn < limit && page_is_used(pfn)) pfn++;
+
+            mark_range_free(start, pfn - start);
+            used_pages -= pfn - start;
+            frames_reset(start, pfn - start, 0, PAGE_OWNER_NONE);
+            buddy_free_range(z, start - z->base_pfn, pfn - z->base_pfn);
         }
     }
-    return NULL;
 }
 
-void free_page(void* page) {
-    uint32_t page_num = (uint32_t)((uintptr_t)page / PAGE_SIZE);
-    if (page_num >= total_pages) return;
+// ---------------------------------------------------------------
+// Frame descriptors
+// ---------------------------------------------------------------
 
-    uint32_t word = page_num / 32;
-    uint32_t bit  = page_num % 32;
+page_frame_t* pfn_to_frame(uint32_t pfn) {
+    return pfn < frame_count ? frame_at(pfn) : NULL;
+}
 
-    if (bitmap[word] & (1u << bit)) {
-        bitmap[word] &= ~(1u << bit);
-        used_pages--;
+page_frame_t* phys_to_frame(uint64_t physical) {
+    uint64_t pfn = physical / PAGE_SIZE;
+    return pfn < frame_count ? frame_at((uint32_t)pfn) : NULL;
+}
+
+void get_page(uint64_t physical) {
+    page_frame_t* frame = phys_to_frame(physical);
+    if (!frame || (frame->flags & PF_RESERVED)) return;
+
+    if (frame->refcount == 0) {
+        kprintf("PMM: get_page(%llx) on a free frame\n", physical);
+        return;
+    }
+    frame->refcount++;
+}
+
+uint32_t page_ref_dec(uint64_t physical) {
+    page_frame_t* frame = phys_to_frame(physical);
+    if (!frame || (frame->flags & PF_RESERVED)) return 1;   // Never freed
+
+    if (frame->refcount == 0) {
+        kprintf("PMM: put_page(%llx) on a free frame\n", physical);
+        return 1;
+    }
+    return --frame->refcount;
+}
+
+uint32_t put_page(uint64_t physical) {
+    uint32_t left = page_ref_dec(physical);
+    if (left == 0) {
+        free_page(pfn_to_addr((uint32_t)(physical / PAGE_SIZE)));
     }
+    return left;
 }
 
-// Keep API returning bytes so other code doesn’t break
-uint32_t get_total_memory(void) { return memory_size_bytes; }
-uint32_t get_free_memory(void)  { return (total_pages - used_pages) * PAGE_SIZE; }
-uint32_t get_used_memory(void)  { return used_pages * PAGE_SIZE; }
+uint32_t page_ref_count(uint64_t physical) {
+    page_frame_t* frame = phys_to_frame(physical);
+    return frame ? frame->refcount : 0;
+}
+
+void page_set_owner(uint64_t physical, uint32_t count, uint32_t owner) {
+    uint64_t pfn = physical / PAGE_SIZE;
+    for (uint32_t i = 0; i < count && pfn + i < frame_count; i++) {
+        frame_at((uint32_t)(pfn + i))->owner = (uint8_t)owner;
+    }
+}
+
+void page_lru_init(page_lru_t* lru) {
+    lru->head = PFN_NONE;
+    lru->tail = PFN_NONE;
+    lru->count = 0;
+}
+
+void page_lru_add(page_lru_t* lru, uint64_t physical) {
+    uint64_t pfn = physical / PAGE_SIZE;
+    if (pfn >= frame_count) return;
+
+    page_frame_t* frame = frame_at((uint32_t)pfn);
+    if (frame->flags & PF_LRU) return;
+
+    frame->lru_prev = PFN_NONE;
+    frame->lru_next = lru->head;
+    if (lru->head != PFN_NONE) {
+        frame_at(lru->head)->lru_prev = (uint32_t)pfn;
+    } else {
+        lru->tail = (uint32_t)pfn;
+    }
+    lru->head = (uint32_t)pfn;
+    lru->count++;
+    frame->flags |= PF_LRU;
+}
+
+void page_lru_del(page_lru_t* lru, uint64_t physical) {
+    uint64_t pfn = physical / PAGE_SIZE;
+    if (pfn >= frame_count) return;
+
+    page_frame_t* frame = frame_at((uint32_t)pfn);
+    if (!(frame->flags & PF_LRU)) return;
+
+    if (frame->lru_prev != PFN_NONE) {
+        frame_at(frame->lru_prev)->lru_next = frame->lru_next;
+    } else {
+        lru->head = frame->lru_next;
+    }
+    if (frame->lru_next != PFN_NONE) {
+        frame_at(frame->lru_next)->lru_prev = frame->lru_prev;
+    } else {
+        lru->tail = frame->lru_prev;
+    }
+    frame->lru_next = PFN_NONE;
+    frame->lru_prev = PFN_NONE;
+    frame->flags &= ~PF_LRU;
+    lru->count--;
+}
+
+uint64_t page_lru_tail(page_lru_t* lru) {
+    return lru->tail == PFN_NONE ? 0 : (uint64_t)lru->tail * PAGE_SIZE;
+}
+
+uint32_t pmm_compact_pick_block(void) {
+    uint32_t best = PFN_NONE;
+    uint32_t best_free = 0;
+
+    for (uint32_t zone = PMM_ZONE_NORMAL; zone < PMM_ZONE_COUNT; zone++) {
+        pmm_zone_t* z = &zones[zone];
+        uint32_t pfn = ALIGN_UP(z->start_pfn, PMM_COMPACT_PAGES);
+
+        for (; pfn + PMM_COMPACT_PAGES <= z->end_pfn; pfn += PMM_COMPACT_PAGES) {
+            if (pfn < reserved_pages) continue;
+            const pmm_region_t* region = region_find(pfn);
+            if (!region || region->end_pfn < pfn + PMM_COMPACT_PAGES) continue;
+
+            uint32_t free = 0;
+            uint32_t i;
+            for (i = 0; i < PMM_COMPACT_PAGES; i++) {
+                if (!page_is_used(pfn + i)) {
+                    free++;
+                } else if (!(frame_at(pfn + i)->flags & PF_MOVABLE)) {
+                    break;
+                }
+            }
+            if (i < PMM_COMPACT_PAGES || free == PMM_COMPACT_PAGES) continue;
+
+            if (best == PFN_NONE || free > best_free) {
+                best = pfn;
+                best_free = free;
+            }
+        }
+    }
+    return best;
+}
+
+uint32_t pmm_isolate_range(uint32_t pfn, uint32_t count) {
+    uint32_t isolated = 0;
+
+    for (uint32_t end = pfn + count; pfn < end && pfn < max_pfn; pfn++) {
+        if (page_is_used(pfn) || pfn < reserved_pages) continue;
+
+        const pmm_region_t* region = region_find(pfn);
+        if (!region) continue;
+
+        pmm_zone_t* z = &zones[region->zone];
+        buddy_claim_page(z, pfn - z->base_pfn);
+        mark_range_used(pfn, 1);
+        used_pages++;
+        frames_reset(pfn, 1, 1, PAGE_OWNER_NONE);
+        isolated++;
+    }
+    return isolated;
+}
+
+void pmm_set_compact_handler(uint32_t (*handler)(uint32_t blocks)) {
+    compact_handler = handler;
+}
+
+void pmm_set_reclaim_handler(uint32_t (*handler)(uint32_t pages)) {
+    reclaim_handler = handler;
+}
+
+void pmm_get_frame_stats(uint32_t* frames, uint64_t* bytes) {
+    if (frames) *frames = frame_count;
+    if (bytes) *bytes = (uint64_t)frame_count * sizeof(page_frame_t);
+}
+
+// Byte counts over usable RAM
+uint64_t get_total_memory(void) { return (uint64_t)total_pages * PAGE_SIZE; }
+uint64_t get_free_memory(void)  { return (uint64_t)(total_pages - used_pages) * PAGE_SIZE; }
+uint64_t get_used_memory(void)  { return (uint64_t)used_pages * PAGE_SIZE; }
 
 // Optional convenience (if you want it)
 uint32_t get_total_memory_mb(void) { return memory_size_mb; }
+
+// Free blocks per order across all zones (for diagnostics)
+uint32_t pmm_get_free_blocks(uint32_t order) {
+    if (order > PMM_MAX_ORDER) return 0;
+
+    uint32_t blocks = 0;
+    for (uint32_t i = 0; i < PMM_ZONE_COUNT; i++) {
+        blocks += zones[i].order_map[order].free_blocks;
+    }
+    return blocks;
+}
+
+int pmm_get_zone_info(uint32_t zone, pmm_zone_info_t* info) {
+    if (zone >= PMM_ZONE_COUNT || !info) return -1;
+
+    pmm_zone_t* z = &zones[zone];
+    info->name = z->name;
+    info->start = (uint64_t)z->start_pfn * PAGE_SIZE;
+    info->end = (uint64_t)z->end_pfn * PAGE_SIZE;
+    info->managed_pages = z->managed_pages;
+    info->free_pages = z->free_pages;
+    return 0;
+}
+
+uint64_t pmm_get_phys_end(void) {
+    return (uint64_t)max_pfn * PAGE_SIZE;
+}
+
+uint32_t pmm_get_region_count(void) {
+    return num_regions;
+}
+
+// Allocation count and total bitmap words examined by the block search
+void pmm_get_scan_stats(uint64_t* allocations, uint64_t* words_scanned) {
+    if (allocations) *allocations = scan_allocs;
+    if (words_scanned) *words_scanned = scan_words;
+}
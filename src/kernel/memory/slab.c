@@ -0,0 +1,282 @@
+// src/kernel/memory/slab.c - Slab object caches for fixed-size kernel objects
+#include "slab.h"
+#include "physical_mm.h"
+#include "paging.h"
+#include "kstring.h"
+#include "serial.h"
+
+#define SLAB_LIST_PARTIAL 0
+#define SLAB_LIST_FULL    1
+#define SLAB_LIST_EMPTY   2
+
+#define SLAB_MAX_ORDER    5   // Largest slab: 32 pages (128KB)
+#define SLAB_MIN_OBJS     8   // Preferred objects per slab
+#define SLAB_MAX_EMPTY    1   // Fully free slabs kept per cache
+
+// Caches are themselves allocated from a statically bootstrapped cache
+static kmem_cache_t cache_cache;
+static int cache_cache_ready = 0;
+static kmem_cache_t* cache_list = NULL;
+
+static inline uint32_t slab_bytes(kmem_cache_t* cache) {
+    return PAGE_SIZE << cache->slab_order;
+}
+
+// Free-pointer location inside a free object. Caches with a constructor
+// keep it past the object so the constructed state survives free().
+static inline void** free_ptr(kmem_cache_t* cache, void* obj) {
+    uint32_t offset = cache->ctor ? cache->obj_size - sizeof(void*) : 0;
+    return (void**)((uint8_t*)obj + offset);
+}
+
+static kmem_slab_t** slab_list_head(kmem_cache_t* cache, uint32_t list) {
+    switch (list) {
+        case SLAB_LIST_PARTIAL: return &cache->partial;
+        case SLAB_LIST_FULL:    return &cache->full;
+        default:                return &cache->empty;
+    }
+}
+
+static void slab_list_push(kmem_cache_t* cache, kmem_slab_t* slab, uint32_t list) {
+    kmem_slab_t** head = slab_list_head(cache, list);
+
+    slab->list = list;
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_remove(kmem_cache_t* cache, kmem_slab_t* slab) {
+    kmem_slab_t** head = slab_list_head(cache, slab->list);
+
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = slab->prev = NULL;
+}
+
+// Allocate a new slab and thread its objects onto the slab free list
+static kmem_slab_t* cache_grow(kmem_cache_t* cache) {
+    // Buddy blocks are naturally aligned, which lets kmem_cache_free()
+    // find the slab header by masking the object address.
+    void* pages = alloc_pages(1u << cache->slab_order);
+    if (!pages) {
+        kprintf("SLAB: Out of pages growing cache '%s'\n", cache->name);
+        return NULL;
+    }
+
+    page_set_owner((uint64_t)(uintptr_t)pages, 1u << cache->slab_order, PAGE_OWNER_SLAB);
+
+    // Slab memory is reached through the physmap, which keeps the
+    // natural alignment of the block
+    kmem_slab_t* slab = (kmem_slab_t*)phys_to_virt((uint64_t)(uintptr_t)pages);
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+
+    uint8_t* base = (uint8_t*)slab + cache->first_offset;
+    for (int32_t i = (int32_t)cache->objs_per_slab - 1; i >= 0; i--) {
+        void* obj = base + (uint32_t)i * cache->obj_size;
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        *free_ptr(cache, obj) = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    slab_list_push(cache, slab, SLAB_LIST_PARTIAL);
+    cache->num_slabs++;
+    return slab;
+}
+
+static void slab_release(kmem_cache_t* cache, kmem_slab_t* slab) {
+    uint64_t pages = virt_to_phys(slab);
+    uint32_t count = 1u << cache->slab_order;
+
+    for (uint32_t i = 0; i < count; i++) {
+        put_page(pages + (uint64_t)i * PAGE_SIZE);
+    }
+    cache->num_slabs--;
+}
+
+static int cache_setup(kmem_cache_t* cache, const char* name, size_t size,
+                       size_t align, void (*ctor)(void* obj)) {
+    if (align == 0) align = 8;
+    if (align & (align - 1)) {
+        kprintf("SLAB: Alignment %d for '%s' is not a power of two\n",
+                (uint32_t)align, name);
+        return -1;
+    }
+    if (size < sizeof(void*)) size = sizeof(void*);
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    strncpy(cache->name, name, sizeof(cache->name) - 1);
+    cache->ctor = ctor;
+
+    // Constructed objects keep their free pointer after the object
+    size_t stride = ctor ? ALIGN_UP(size, 8) + sizeof(void*) : size;
+    cache->obj_size = (uint32_t)ALIGN_UP(stride, align);
+    cache->first_offset = (uint32_t)ALIGN_UP(sizeof(kmem_slab_t), align);
+
+    // Smallest slab that fits SLAB_MIN_OBJS objects or wastes <= 1/8
+    for (uint32_t order = 0; order <= SLAB_MAX_ORDER; order++) {
+        uint32_t bytes = PAGE_SIZE << order;
+        if (cache->first_offset + cache->obj_size > bytes) continue;
+
+        uint32_t count = (bytes - cache->first_offset) / cache->obj_size;
+        uint32_t waste = bytes - cache->first_offset - count * cache->obj_size;
+
+        cache->slab_order = order;
+        cache->objs_per_slab = count;
+        if (count >= SLAB_MIN_OBJS || waste * 8 <= bytes) break;
+    }
+
+    if (cache->objs_per_slab == 0) {
+        kprintf("SLAB: Object size %d too large for cache '%s'\n",
+                (uint32_t)size, name);
+        return -1;
+    }
+
+    cache->next = cache_list;
+    cache_list = cache;
+    return 0;
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                void (*ctor)(void* obj)) {
+    if (!cache_cache_ready) {
+        if (cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 8, NULL) < 0) {
+            return NULL;
+        }
+        cache_cache_ready = 1;
+    }
+
+    kmem_cache_t* cache = (kmem_cache_t*)kmem_cache_alloc(&cache_cache);
+    if (!cache) return NULL;
+
+    if (cache_setup(cache, name, size, align, ctor) < 0) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+
+    kprintf("SLAB: Created cache '%s' (obj=%d bytes, %d per %d KB slab)\n",
+            cache->name, cache->obj_size, cache->objs_per_slab,
+            slab_bytes(cache) / 1024);
+    return cache;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    if (!cache) return NULL;
+
+    kmem_slab_t* slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_remove(cache, slab);
+            slab_list_push(cache, slab, SLAB_LIST_PARTIAL);
+            cache->num_empty--;
+        } else {
+            slab = cache_grow(cache);
+            if (!slab) return NULL;
+        }
+    }
+
+    void* obj = slab->free_list;
+    slab->free_list = *free_ptr(cache, obj);
+    slab->in_use++;
+
+    if (!slab->free_list) {
+        slab_list_remove(cache, slab);
+        slab_list_push(cache, slab, SLAB_LIST_FULL);
+    }
+
+    cache->objs_in_use++;
+    cache->total_allocs++;
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    if (!cache || !obj) return;
+
+    kmem_slab_t* slab = (kmem_slab_t*)((uintptr_t)obj & ~(uintptr_t)(slab_bytes(cache) - 1));
+    if (slab->cache != cache) {
+        kprintf("SLAB: Invalid free of %x to cache '%s'\n",
+                (uint32_t)(uintptr_t)obj, cache->name);
+        return;
+    }
+
+    int was_full = (slab->list == SLAB_LIST_FULL);
+
+    *free_ptr(cache, obj) = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    cache->objs_in_use--;
+
+    if (slab->in_use == 0) {
+        slab_list_remove(cache, slab);
+        if (cache->num_empty < SLAB_MAX_EMPTY) {
+            slab_list_push(cache, slab, SLAB_LIST_EMPTY);
+            cache->num_empty++;
+        } else {
+            slab_release(cache, slab);
+        }
+    } else if (was_full) {
+        slab_list_remove(cache, slab);
+        slab_list_push(cache, slab, SLAB_LIST_PARTIAL);
+    }
+}
+
+uint32_t kmem_cache_shrink(kmem_cache_t* cache) {
+    if (!cache) return 0;
+
+    uint32_t released = 0;
+    while (cache->empty) {
+        kmem_slab_t* slab = cache->empty;
+        slab_list_remove(cache, slab);
+        slab_release(cache, slab);
+        cache->num_empty--;
+        released += 1u << cache->slab_order;
+    }
+    return released;
+}
+
+void kmem_cache_destroy(kmem_cache_t* cache) {
+    if (!cache || cache == &cache_cache) return;
+
+    if (cache->objs_in_use) {
+        kprintf("SLAB: Destroying cache '%s' with %d objects in use\n",
+                cache->name, cache->objs_in_use);
+        return;
+    }
+
+    kmem_cache_shrink(cache);
+
+    kmem_cache_t** current = &cache_list;
+    while (*current) {
+        if (*current == cache) {
+            *current = cache->next;
+            break;
+        }
+        current = &(*current)->next;
+    }
+
+    kmem_cache_free(&cache_cache, cache);
+}
+
+void kmem_cache_debug_print(void) {
+    kprintf("\n=== SLAB CACHES ===\n");
+    for (kmem_cache_t* cache = cache_list; cache; cache = cache->next) {
+        kprintf("%s: obj=%d in_use=%d slabs=%d (empty=%d) allocs=%d\n",
+                cache->name, cache->obj_size, cache->objs_in_use,
+                cache->num_slabs, cache->num_empty, cache->total_allocs);
+    }
+    kprintf("===================\n\n");
+}
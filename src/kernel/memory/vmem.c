@@ -0,0 +1,264 @@
+// src/kernel/memory/vmem.c - Coalescing virtual address space allocator
+#include "vmem.h"
+#include "slab.h"
+#include "kstring.h"
+#include "serial.h"
+
+// Segment descriptors come from a slab, so there is no fixed limit
+static kmem_cache_t* seg_cache = NULL;
+
+static inline uint32_t floor_log2(uint64_t x) {
+    return 63 - __builtin_clzll(x);
+}
+
+static inline uint32_t ceil_log2(uint64_t x) {
+    return (x <= 1) ? 0 : floor_log2(x - 1) + 1;
+}
+
+static inline uint32_t hash_index(vmem_t* vm, uint64_t addr) {
+    uint64_t q = addr / vm->quantum;
+    return (uint32_t)((q ^ (q >> 9)) % VMEM_HASH_SIZE);
+}
+
+static vmem_seg_t* seg_alloc(void) {
+    vmem_seg_t* seg = (vmem_seg_t*)kmem_cache_alloc(seg_cache);
+    if (seg) memset(seg, 0, sizeof(vmem_seg_t));
+    return seg;
+}
+
+// ---------------------------------------------------------------
+// Free lists and hash
+// ---------------------------------------------------------------
+
+static void list_insert(vmem_seg_t** head, vmem_seg_t* seg) {
+    seg->list_prev = NULL;
+    seg->list_next = *head;
+    if (*head) (*head)->list_prev = seg;
+    *head = seg;
+}
+
+static void list_remove(vmem_seg_t** head, vmem_seg_t* seg) {
+    if (seg->list_prev) {
+        seg->list_prev->list_next = seg->list_next;
+    } else {
+        *head = seg->list_next;
+    }
+    if (seg->list_next) seg->list_next->list_prev = seg->list_prev;
+    seg->list_next = seg->list_prev = NULL;
+}
+
+static void free_insert(vmem_t* vm, vmem_seg_t* seg) {
+    uint32_t index = floor_log2(seg->size);
+    seg->is_free = 1;
+    list_insert(&vm->freelist[index], seg);
+    vm->freemap |= 1ULL << index;
+    vm->num_free_segments++;
+}
+
+static void free_remove(vmem_t* vm, vmem_seg_t* seg) {
+    uint32_t index = floor_log2(seg->size);
+    list_remove(&vm->freelist[index], seg);
+    if (!vm->freelist[index]) vm->freemap &= ~(1ULL << index);
+    seg->is_free = 0;
+    vm->num_free_segments--;
+}
+
+static vmem_seg_t* hash_find(vmem_t* vm, uint64_t addr) {
+    vmem_seg_t* seg = vm->hash[hash_index(vm, addr)];
+    while (seg && seg->start != addr) seg = seg->list_next;
+    return seg;
+}
+
+// ---------------------------------------------------------------
+// Segment list
+// ---------------------------------------------------------------
+
+// Split seg at offset; the new upper part follows seg in address order
+static vmem_seg_t* seg_split(vmem_t* vm, vmem_seg_t* seg, uint64_t offset) {
+    vmem_seg_t* upper = seg_alloc();
+    if (!upper) return NULL;
+
+    upper->start = seg->start + offset;
+    upper->size = seg->size - offset;
+    seg->size = offset;
+
+    upper->addr_prev = seg;
+    upper->addr_next = seg->addr_next;
+    if (seg->addr_next) seg->addr_next->addr_prev = upper;
+    seg->addr_next = upper;
+
+    vm->num_segments++;
+    return upper;
+}
+
+// Absorb seg->addr_next into seg
+static void seg_merge_next(vmem_t* vm, vmem_seg_t* seg) {
+    vmem_seg_t* next = seg->addr_next;
+
+    seg->size += next->size;
+    seg->addr_next = next->addr_next;
+    if (next->addr_next) next->addr_next->addr_prev = seg;
+
+    kmem_cache_free(seg_cache, next);
+    vm->num_segments--;
+}
+
+// Does seg hold `size` bytes at `align`? Returns the aligned start or 0.
+static uint64_t seg_fit(vmem_seg_t* seg, uint64_t size, uint64_t align) {
+    uint64_t start = ALIGN_UP(seg->start, align);
+    if (start < seg->start || start + size > seg->start + seg->size) return 0;
+    return start;
+}
+
+// ---------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------
+
+int vmem_init(vmem_t* vm, const char* name, uint64_t base, uint64_t size, uint64_t quantum) {
+    if (!quantum || (quantum & (quantum - 1)) || (base | size) & (quantum - 1) || !size) {
+        kprintf("VMEM: Bad arena geometry for '%s'\n", name);
+        return -1;
+    }
+
+    if (!seg_cache) {
+        seg_cache = kmem_cache_create("vmem_seg", sizeof(vmem_seg_t), 0, NULL);
+        if (!seg_cache) return -1;
+    }
+
+    memset(vm, 0, sizeof(vmem_t));
+    strncpy(vm->name, name, sizeof(vm->name) - 1);
+    vm->base = base;
+    vm->size = size;
+    vm->quantum = quantum;
+
+    vmem_seg_t* seg = seg_alloc();
+    if (!seg) return -1;
+    seg->start = base;
+    seg->size = size;
+
+    vm->segments = seg;
+    vm->num_segments = 1;
+    free_insert(vm, seg);
+    return 0;
+}
+
+uint64_t vmem_alloc(vmem_t* vm, uint64_t size, uint64_t align) {
+    if (!size) return 0;
+    size = ALIGN_UP(size, vm->quantum);
+    if (align < vm->quantum) align = vm->quantum;
+    if (align & (align - 1)) return 0;
+
+    // Instant fit: any segment in list ceil_log2(size) or above is big
+    // enough, so the first one found is taken. Aligned requests may need
+    // to look past the head of a list.
+    vmem_seg_t* found = NULL;
+    uint64_t start = 0;
+    uint32_t index = ceil_log2(size);
+
+    if (index < VMEM_FREELISTS) {
+        uint64_t map = vm->freemap & (~0ULL << index);
+        while (map && !found) {
+            uint32_t i = __builtin_ctzll(map);
+            for (vmem_seg_t* seg = vm->freelist[i]; seg; seg = seg->list_next) {
+                if ((start = seg_fit(seg, size, align)) != 0) {
+                    found = seg;
+                    break;
+                }
+            }
+            map &= map - 1;
+        }
+    }
+
+    // The list below may still hold a segment that happens to be large enough
+    if (!found && index > 0 && floor_log2(size) != index) {
+        for (vmem_seg_t* seg = vm->freelist[floor_log2(size)]; seg; seg = seg->list_next) {
+            if ((start = seg_fit(seg, size, align)) != 0) {
+                found = seg;
+                break;
+            }
+        }
+    }
+
+    if (!found) return 0;
+
+    // Carve [start, start + size) out of the free segment
+    free_remove(vm, found);
+
+    if (start > found->start) {
+        vmem_seg_t* rest = seg_split(vm, found, start - found->start);
+        if (!rest) {
+            free_insert(vm, found);
+            return 0;
+        }
+        free_insert(vm, found);     // Leading gap stays free
+        found = rest;
+    }
+    if (found->size > size) {
+        vmem_seg_t* tail = seg_split(vm, found, size);
+        if (!tail) {
+            // Out of descriptors: hand out the whole segment
+            size = found->size;
+        } else {
+            free_insert(vm, tail);
+        }
+    }
+
+    list_insert(&vm->hash[hash_index(vm, found->start)], found);
+    vm->in_use += found->size;
+    vm->allocs++;
+    return found->start;
+}
+
+uint64_t vmem_free(vmem_t* vm, uint64_t addr) {
+    vmem_seg_t* seg = hash_find(vm, addr);
+    if (!seg) {
+        kprintf("VMEM: '%s' free of unknown address %llx\n", vm->name, addr);
+        return 0;
+    }
+
+    uint64_t size = seg->size;
+    list_remove(&vm->hash[hash_index(vm, addr)], seg);
+    vm->in_use -= size;
+    vm->frees++;
+
+    // Coalesce with free neighbours
+    vmem_seg_t* next = seg->addr_next;
+    if (next && next->is_free) {
+        free_remove(vm, next);
+        seg_merge_next(vm, seg);
+    }
+    vmem_seg_t* prev = seg->addr_prev;
+    if (prev && prev->is_free) {
+        free_remove(vm, prev);
+        seg_merge_next(vm, prev);
+        seg = prev;
+    }
+
+    free_insert(vm, seg);
+    return size;
+}
+
+uint64_t vmem_size(vmem_t* vm, uint64_t addr) {
+    vmem_seg_t* seg = hash_find(vm, addr);
+    return seg ? seg->size : 0;
+}
+
+void vmem_get_stats(vmem_t* vm, vmem_stats_t* stats) {
+    if (!stats) return;
+
+    stats->total = vm->size;
+    stats->in_use = vm->in_use;
+    stats->num_segments = vm->num_segments;
+    stats->num_free_segments = vm->num_free_segments;
+    stats->allocs = vm->allocs;
+    stats->frees = vm->frees;
+
+    // Largest free segment lives in the highest non-empty list
+    stats->largest_free = 0;
+    if (vm->freemap) {
+        uint32_t top = floor_log2(vm->freemap);
+        for (vmem_seg_t* seg = vm->freelist[top]; seg; seg = seg->list_next) {
+            if (seg->size > stats->largest_free) stats->largest_free = seg->size;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+// src/kernel/memory/zero_pool.c - Pool of pre-zeroed physical pages
+#include "zero_pool.h"
+#include "physical_mm.h"
+#include "paging.h"
+
+// Physical addresses of zeroed pages, used as a stack
+static uint64_t pool[ZERO_POOL_SIZE];
+static uint32_t pool_depth = 0;
+
+static zero_pool_stats_t stats;
+
+static inline void zero_bytes(void* dst, uint64_t bytes) {
+    uint64_t count = bytes / 8;
+    __asm__ volatile("rep stosq"
+                     : "+D"(dst), "+c"(count)
+                     : "a"(0ULL)
+                     : "memory");
+}
+
+void* alloc_pages_flags(uint32_t count, uint32_t flags) {
+    if ((flags & ALLOC_ZERO) && count == 1 && pool_depth > 0) {
+        stats.hits++;
+        return (void*)(uintptr_t)pool[--pool_depth];
+    }
+
+    void* pages = alloc_pages(count);
+    if (pages && (flags & ALLOC_ZERO)) {
+        if (count == 1) stats.misses++;
+        zero_bytes(phys_to_virt((uint64_t)(uintptr_t)pages), (uint64_t)count * PAGE_SIZE);
+    }
+    return pages;
+}
+
+void* alloc_page_zeroed(void) {
+    return alloc_pages_flags(1, ALLOC_ZERO);
+}
+
+void zero_pool_refill(void) {
+    uint32_t filled = 0;
+
+    if (get_free_memory() / PAGE_SIZE < RECLAIM_LOW_PAGES) return;
+
+    while (pool_depth < ZERO_POOL_SIZE && filled < ZERO_POOL_BATCH) {
+        void* page = alloc_page();
+        if (!page) break;
+
+        zero_bytes(phys_to_virt((uint64_t)(uintptr_t)page), PAGE_SIZE);
+        pool[pool_depth++] = (uint64_t)(uintptr_t)page;
+        filled++;
+    }
+
+    if (filled) {
+        stats.pages_refilled += filled;
+        stats.refill_passes++;
+    }
+}
+
+uint32_t zero_pool_drain(void) {
+    uint32_t drained = pool_depth;
+
+    while (pool_depth > 0) {
+        free_page((void*)(uintptr_t)pool[--pool_depth]);
+    }
+    stats.pages_drained += drained;
+    return drained;
+}
+
+void zero_pool_get_stats(zero_pool_stats_t* out) {
+    if (!out) return;
+
+    *out = stats;
+    out->depth = pool_depth;
+    out->capacity = ZERO_POOL_SIZE;
+}
@@ -0,0 +1,240 @@
+// src/kernel/memory/zram.c - Compressed in-RAM store for evicted pages
+#include "zram.h"
+#include "heap.h"
+#include "kstring.h"
+#include "serial.h"
+
+#define ZRAM_PAGE_SIZE  4096
+
+// LZ77 in the LZ4 block layout. A sequence is a token (literal count in
+// the high nibble, match length - 4 in the low one; 15 means more length
+// bytes follow), the literals, then a 16-bit offset and the extra match
+// length. The last sequence is literals only and ends the page.
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    12
+#define LZ_MAX_OFFSET   0xFFFF
+
+typedef struct {
+    uint8_t* data;              // Pool copy, NULL for an all-zero page
+    uint16_t length;
+    uint16_t used;
+    uint32_t next_free;
+} zram_slot_t;
+
+static zram_slot_t slots[ZRAM_MAX_SLOTS];
+static uint32_t free_head = 0;
+static int slots_ready = 0;
+
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+static uint8_t lz_buffer[ZRAM_MAX_STORED];
+
+static zram_stats_t stats;
+
+static inline uint32_t load32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Length nibble plus 255-continued extra bytes; returns the new output
+// position or 0 on overflow
+static uint32_t lz_put_length(uint8_t* dst, uint32_t op, uint32_t cap, uint32_t length) {
+    for (length -= 15; ; length -= 255) {
+        if (op >= cap) return 0;
+        if (length < 255) {
+            dst[op++] = (uint8_t)length;
+            return op;
+        }
+        dst[op++] = 255;
+    }
+}
+
+// One sequence; match_length 0 marks the final, literals-only one
+static uint32_t lz_emit(uint8_t* dst, uint32_t op, uint32_t cap, const uint8_t* literals,
+                        uint32_t literal_length, uint32_t offset, uint32_t match_length) {
+    uint32_t extra = match_length ? match_length - LZ_MIN_MATCH : 0;
+
+    if (op >= cap) return 0;
+    uint32_t token = op++;
+    dst[token] = (uint8_t)(((literal_length < 15 ? literal_length : 15) << 4) |
+                           (extra < 15 ? extra : 15));
+
+    if (literal_length >= 15 && !(op = lz_put_length(dst, op, cap, literal_length))) return 0;
+    if (op + literal_length > cap) return 0;
+    memcpy(dst + op, literals, literal_length);
+    op += literal_length;
+
+    if (!match_length) return op;
+
+    if (op + 2 > cap) return 0;
+    dst[op++] = (uint8_t)offset;
+    dst[op++] = (uint8_t)(offset >> 8);
+    if (extra >= 15 && !(op = lz_put_length(dst, op, cap, extra))) return 0;
+    return op;
+}
+
+// Compress a page into dst; 0 if it does not fit in cap bytes
+static uint32_t lz_compress(const uint8_t* src, uint8_t* dst, uint32_t cap) {
+    uint32_t ip = 0, anchor = 0, op = 0;
+
+    memset(lz_table, 0, sizeof(lz_table));
+
+    while (ip + LZ_MIN_MATCH <= ZRAM_PAGE_SIZE) {
+        uint32_t sequence = load32(src + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        uint32_t ref = lz_table[hash];
+        lz_table[hash] = (uint16_t)ip;
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || load32(src + ref) != sequence) {
+            ip++;
+            continue;
+        }
+
+        uint32_t length = LZ_MIN_MATCH;
+        while (ip + length < ZRAM_PAGE_SIZE && src[ref + length] == src[ip + length]) {
+            length++;
+        }
+
+        op = lz_emit(dst, op, cap, src + anchor, ip - anchor, ip - ref, length);
+        if (!op) return 0;
+        ip += length;
+        anchor = ip;
+    }
+
+    return lz_emit(dst, op, cap, src + anchor, ZRAM_PAGE_SIZE - anchor, 0, 0);
+}
+
+// Read a 255-continued length; -1 past the end of the input
+static int32_t lz_get_length(const uint8_t* src, uint32_t* ip, uint32_t length, uint32_t base) {
+    uint32_t byte;
+    do {
+        if (*ip >= length) return -1;
+        byte = src[(*ip)++];
+        base += byte;
+    } while (byte == 255);
+    return (int32_t)base;
+}
+
+static int lz_decompress(const uint8_t* src, uint32_t length, uint8_t* dst) {
+    uint32_t ip = 0, op = 0;
+
+    while (op < ZRAM_PAGE_SIZE) {
+        if (ip >= length) return -1;
+        uint32_t token = src[ip++];
+
+        int32_t literals = token >> 4;
+        if (literals == 15 && (literals = lz_get_length(src, &ip, length, 15)) < 0) return -1;
+        if (ip + literals > length || op + literals > ZRAM_PAGE_SIZE) return -1;
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        if (op == ZRAM_PAGE_SIZE) break;
+
+        if (ip + 2 > length) return -1;
+        uint32_t offset = src[ip] | ((uint32_t)src[ip + 1] << 8);
+        ip += 2;
+
+        int32_t match = token & 15;
+        if (match == 15 && (match = lz_get_length(src, &ip, length, 15)) < 0) return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || op + match > ZRAM_PAGE_SIZE) return -1;
+
+        // Byte copy: the match may overlap the bytes it produces
+        for (const uint8_t* from = dst + op - offset; match > 0; match--) {
+            dst[op++] = *from++;
+        }
+    }
+    return 0;
+}
+
+static int page_is_zero(const void* page) {
+    const uint64_t* words = (const uint64_t*)page;
+    for (uint32_t i = 0; i < ZRAM_PAGE_SIZE / 8; i++) {
+        if (words[i]) return 0;
+    }
+    return 1;
+}
+
+static void slots_init(void) {
+    for (uint32_t i = 0; i < ZRAM_MAX_SLOTS; i++) {
+        slots[i].next_free = i + 1;
+    }
+    free_head = 0;
+    slots_ready = 1;
+}
+
+static void slot_release(uint32_t slot) {
+    zram_slot_t* s = &slots[slot];
+
+    if (s->data) {
+        kfree(s->data);
+        stats.compr_bytes -= s->length;
+    } else {
+        stats.zero_pages--;
+    }
+    stats.orig_bytes -= ZRAM_PAGE_SIZE;
+    stats.stored_pages--;
+
+    s->data = NULL;
+    s->used = 0;
+    s->next_free = free_head;
+    free_head = slot;
+}
+
+int32_t zram_store(const void* page) {
+    if (!slots_ready) slots_init();
+    if (free_head >= ZRAM_MAX_SLOTS) {
+        stats.rejects++;
+        return -1;
+    }
+
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    if (!page_is_zero(page)) {
+        length = lz_compress((const uint8_t*)page, lz_buffer, sizeof(lz_buffer));
+        if (length) data = (uint8_t*)kmalloc_tagged(length, "zram");
+        if (!data) {
+            stats.rejects++;
+            return -1;
+        }
+        memcpy(data, lz_buffer, length);
+    }
+
+    uint32_t slot = free_head;
+    zram_slot_t* s = &slots[slot];
+    free_head = s->next_free;
+    s->data = data;
+    s->length = (uint16_t)length;
+    s->used = 1;
+
+    stats.stored_pages++;
+    stats.orig_bytes += ZRAM_PAGE_SIZE;
+    stats.compr_bytes += length;
+    if (!data) stats.zero_pages++;
+    stats.stores++;
+    return (int32_t)slot;
+}
+
+int zram_load(uint32_t slot, void* page) {
+    if (slot >= ZRAM_MAX_SLOTS || !slots[slot].used) return -1;
+
+    zram_slot_t* s = &slots[slot];
+    if (!s->data) {
+        memset(page, 0, ZRAM_PAGE_SIZE);
+    } else if (lz_decompress(s->data, s->length, (uint8_t*)page) < 0) {
+        kprintf("ZRAM: Slot %u is corrupt\n", slot);
+        return -1;
+    }
+
+    slot_release(slot);
+    stats.loads++;
+    return 0;
+}
+
+void zram_drop(uint32_t slot) {
+    if (slot >= ZRAM_MAX_SLOTS || !slots[slot].used) return;
+    slot_release(slot);
+}
+
+void zram_get_stats(zram_stats_t* out) {
+    if (out) *out = stats;
+}
@@ -7,10 +7,21 @@
 #include "metafs.h"
 #include "system.h"
 #include "executable.h"
+#include "physical_mm.h"
+#include "arena.h"
+#include "zero_pool.h"
+#include "paging.h"
+#include "zram.h"
+#include "kzone.h"
+#include "timer.h"
+#include "process.h"
 
 static metafs_context_t* shell_metafs;
 static char current_view[64] = "";  // Empty = show all objects
 
+// Scratch memory for the running command, released when it returns
+static arena_t* cmd_arena = NULL;
+
 // Environment variables
 #define MAX_ENV_VARS 50
 typedef struct {
@@ -33,6 +44,12 @@ static void cmd_ls(int argc, char** argv);
 static void cmd_cat(int argc, char** argv);
 static void cmd_info(int argc, char** argv);
 static void cmd_mem(int argc, char** argv);
+static void cmd_heapstat(int argc, char** argv);
+static void cmd_tlbbench(int argc, char** argv);
+static void cmd_ctxbench(int argc, char** argv);
+static void cmd_compact(int argc, char** argv);
+static void cmd_reclaim(int argc, char** argv);
+static void cmd_uptime(int argc, char** argv);
 static void cmd_view(int argc, char** argv);
 static void cmd_echo(int argc, char** argv);
 static void cmd_export(int argc, char** argv);
@@ -49,6 +66,7 @@ static void cmd_sysinfo(int argc, char** argv);
 static void cmd_views(int argc, char** argv);
 static void cmd_font(int argc, char** argv);
 static void cmd_gfx(int argc, char** argv);
+static int to_int(const char* s);
 
 
 // Command structure
@@ -65,6 +83,12 @@ static command_t commands[] = {
     {"cat", "Display object contents by name or ID", cmd_cat},
     {"info", "Show object metadata", cmd_info},
     {"mem", "Show memory statistics", cmd_mem},
+    {"heapstat", "Heap profile by call site (dump: to serial)", cmd_heapstat},
+    {"tlbbench", "Measure address-space switch cost", cmd_tlbbench},
+    {"ctxbench", "Measure thread switch cost with and without SSE", cmd_ctxbench},
+    {"compact", "Migrate kernel pages to free 2MB blocks", cmd_compact},
+    {"reclaim", "Compress cold RAM-disk pages to zram", cmd_reclaim},
+    {"uptime", "Show time since boot and timer statistics", cmd_uptime},
     {"view", "Switch current view filter", cmd_view},
     {"echo", "Display text or variables", cmd_echo},
     {"export", "Set environment variable", cmd_export},
@@ -220,7 +244,10 @@ void shell_execute(char* line) {
     // Normal command lookup
     for (int i = 0; commands[i].name != NULL; i++) {
         if (strcmp(argv[0], commands[i].name) == 0) {
+            cmd_arena = arena_create();
             commands[i].handler(argc, argv);
+            arena_destroy(cmd_arena);
+            cmd_arena = NULL;
             return;
         }
     }
@@ -401,7 +428,12 @@ static void cmd_cat(int argc, char** argv) {
         return;
     }
     
-    char* buffer = (char*)kmalloc(4096);
+    char* buffer = (char*)arena_alloc(cmd_arena, 4096);
+    if (!buffer) {
+        terminal_writeln("cat: out of memory");
+        return;
+    }
+
     int bytes = metafs_object_read_data(shell_metafs, id, buffer, 4095);
     
     if (bytes > 0) {
@@ -411,8 +443,6 @@ static void cmd_cat(int argc, char** argv) {
     } else {
         terminal_writeln("(empty)");
     }
-    
-    kfree(buffer);
 }
 
 static void cmd_info(int argc, char** argv) {
@@ -457,6 +487,8 @@ static void cmd_mem(int argc, char** argv) {
     (void)argc; (void)argv;
     
     extern void paging_get_stats(uint64_t*, uint64_t*, uint64_t*, uint64_t*);
+    extern uint32_t paging_get_huge_count(void);
+    extern uint32_t paging_get_tlb_full_flushes(void);
     extern void heap_get_stats(heap_stats_t*);
     
     uint64_t total_virt, used_virt, total_phys, used_phys; 
@@ -470,17 +502,297 @@ static void cmd_mem(int argc, char** argv) {
                     (uint32_t)(total_phys / 1024 / 1024),
                     (uint32_t)(used_phys / 1024 / 1024),
                     (uint32_t)((total_phys - used_phys) / 1024 / 1024));
+    for (uint32_t zone = 0; zone < PMM_ZONE_COUNT; zone++) {
+        pmm_zone_info_t info;
+        if (pmm_get_zone_info(zone, &info) < 0 || info.managed_pages == 0) continue;
+        terminal_printf("    %-7s %u KB managed, %u KB free\n", info.name,
+                        info.managed_pages * 4, info.free_pages * 4);
+    }
     
-    terminal_printf("  Virtual:  %d MB range, %d KB used\n",
+    terminal_printf("  Virtual:  %d MB range, %d KB used, %u 2MB pages, %u CR3 flushes\n",
                     (uint32_t)(total_virt / 1024 / 1024),
-                    (uint32_t)(used_virt / 1024));
+                    (uint32_t)(used_virt / 1024), paging_get_huge_count(),
+                    paging_get_tlb_full_flushes());
+
+    uint64_t lazy_faults, lazy_pending;
+    paging_get_lazy_stats(&lazy_faults, &lazy_pending);
+    terminal_printf("  Demand:   %u zero-fill faults, %u KB reserved but untouched\n",
+                    (uint32_t)lazy_faults, (uint32_t)(lazy_pending * 4));
+
+    uint64_t cow_faults, cow_copies;
+    paging_get_cow_stats(&cow_faults, &cow_copies);
+    terminal_printf("  COW:      %u write faults, %u pages copied\n",
+                    (uint32_t)cow_faults, (uint32_t)cow_copies);
+
+    paging_compact_stats_t compact;
+    paging_get_compact_stats(&compact);
+    terminal_printf("  Compact:  %u runs (%u on failed allocs), %u pages migrated, %u 2MB blocks freed\n",
+                    compact.runs, compact.auto_runs, (uint32_t)compact.pages_migrated,
+                    (uint32_t)compact.blocks_freed);
+
+    zram_stats_t zram;
+    paging_reclaim_stats_t reclaim;
+    zram_get_stats(&zram);
+    paging_get_reclaim_stats(&reclaim);
+    uint32_t ratio_x100 = zram.compr_bytes ? (uint32_t)(zram.orig_bytes * 100 / zram.compr_bytes) : 0;
+    terminal_printf("  Zram:     %u pages (%u zero), %u KB -> %u KB (%u.%02ux), %u rejected\n",
+                    zram.stored_pages, zram.zero_pages, (uint32_t)(zram.orig_bytes / 1024),
+                    (uint32_t)(zram.compr_bytes / 1024), ratio_x100 / 100, ratio_x100 % 100,
+                    (uint32_t)zram.rejects);
+    terminal_printf("  Reclaim:  %u runs, %u pages out, %u faults in (%u cycles avg)\n",
+                    reclaim.runs, (uint32_t)reclaim.pages_reclaimed, (uint32_t)reclaim.faults,
+                    reclaim.faults ? (uint32_t)(reclaim.fault_cycles / reclaim.faults) : 0);
+
+    vmem_stats_t va;
+    paging_get_vmem_stats(&va);
+    terminal_printf("  VA space: %u segments (%u free), largest free %u MB, %u allocs, %u frees\n",
+                    va.num_segments, va.num_free_segments,
+                    (uint32_t)(va.largest_free / 1024 / 1024),
+                    (uint32_t)va.allocs, (uint32_t)va.frees);
     
     heap_stats_t stats;
     heap_get_stats(&stats);
     terminal_printf("  Heap:     %d MB total, %d KB used, %d MB free\n",
-                    stats.total_size / 1024 / 1024,
-                    stats.used_size / 1024,
-                    stats.free_size / 1024 / 1024);
+                    (uint32_t)(stats.total_size / 1024 / 1024),
+                    (uint32_t)(stats.used_size / 1024),
+                    (uint32_t)(stats.free_size / 1024 / 1024));
+    terminal_printf("  Large:    %d allocations, %d KB (page-granular)\n",
+                    stats.num_large, (uint32_t)(stats.large_size / 1024));
+
+    terminal_printf("  Zones:    %u (free memory reclaim below %u MB)\n", kzone_count(),
+                    (uint32_t)(KZONE_LOW_WATERMARK / 1024 / 1024));
+    for (uint32_t i = 0; i < kzone_count(); i++) {
+        const kzone_t* zone = kzone_get(i);
+        terminal_printf("    %-8s %u KB charged, %u KB peak", zone->name,
+                        (uint32_t)(zone->live / 1024), (uint32_t)(zone->peak / 1024));
+        if (zone->quota) {
+            terminal_printf(" of %u KB", (uint32_t)(zone->quota / 1024));
+        }
+        terminal_printf(", %u allocs, %u denied", zone->allocs, zone->denied);
+        if (zone->reclaim) {
+            terminal_printf(", %u KB reclaimed", (uint32_t)(zone->reclaimed / 1024));
+        }
+        terminal_printf("\n");
+    }
+
+    if (shell_metafs && shell_metafs->volume) {
+        exfat_buffer_pool_t* pool = &shell_metafs->volume->pool;
+        terminal_printf("  FS pool:  %u hits, %u misses\n", pool->hits, pool->misses);
+    }
+
+    arena_stats_t arenas;
+    arena_get_stats(&arenas);
+    terminal_printf("  Arenas:   %u created, %u chunks reused, %u allocated, %u pooled\n",
+                    arenas.arenas_created, arenas.chunk_reuses,
+                    arenas.chunk_allocs, arenas.chunks_pooled);
+
+    zero_pool_stats_t zero;
+    zero_pool_get_stats(&zero);
+    terminal_printf("  Zeroed:   %u/%u pages ready, %u hits, %u misses, %u refilled in %u idle passes, %u drained\n",
+                    zero.depth, zero.capacity, (uint32_t)zero.hits, (uint32_t)zero.misses,
+                    (uint32_t)zero.pages_refilled, (uint32_t)zero.refill_passes,
+                    (uint32_t)zero.pages_drained);
+
+    uint32_t frames;
+    uint64_t frame_bytes;
+    pmm_get_frame_stats(&frames, &frame_bytes);
+    uint32_t frame_permille = total_phys ? (uint32_t)(frame_bytes * 1000 / total_phys) : 0;
+    terminal_printf("  Frames:   %u descriptors, %u KB (%u.%u%% of RAM)\n", frames,
+                    (uint32_t)(frame_bytes / 1024), frame_permille / 10, frame_permille % 10);
+
+    uint64_t scan_allocs, scan_words;
+    pmm_get_scan_stats(&scan_allocs, &scan_words);
+    uint32_t avg_x100 = scan_allocs ? (uint32_t)(scan_words * 100 / scan_allocs) : 0;
+    terminal_printf("  PMM scan: %u allocs, %u words examined (%u.%02u words/alloc)\n",
+                    (uint32_t)scan_allocs, (uint32_t)scan_words,
+                    avg_x100 / 100, avg_x100 % 100);
+}
+
+static void cmd_tlbbench(int argc, char** argv) {
+    uint32_t iterations = 1000;
+    if (argc > 1) {
+        int value = to_int(argv[1]);
+        if (value < 1) {
+            terminal_writeln("usage: tlbbench [iterations]");
+            return;
+        }
+        iterations = (uint32_t)value;
+    }
+
+    paging_switch_bench_t bench;
+    if (paging_switch_benchmark(iterations, 64, &bench) < 0) {
+        terminal_writeln("tlbbench: out of memory");
+        return;
+    }
+
+    terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+    terminal_printf("Switch cost (%u round trips, %u private + %u kernel pages touched):\n",
+                    bench.iterations, bench.pages, bench.pages);
+    terminal_setcolor(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    terminal_printf("  Full flush:  %u cycles (no global pages)\n", (uint32_t)bench.full_flush);
+    terminal_printf("  CR3 reload:  %u cycles (global kernel entries kept)\n",
+                    (uint32_t)bench.cr3_reload);
+    if (bench.pcid) {
+        terminal_printf("  PCID:        %u cycles (private entries kept too)\n", (uint32_t)bench.pcid);
+    } else {
+        terminal_writeln("  PCID:        unsupported");
+    }
+}
+
+static void cmd_ctxbench(int argc, char** argv) {
+    uint32_t rounds = 1000;
+    if (argc > 1) {
+        int value = to_int(argv[1]);
+        if (value < 1) {
+            terminal_writeln("usage: ctxbench [rounds]");
+            return;
+        }
+        rounds = (uint32_t)value;
+    }
+
+    process_switch_bench_t plain, fpu;
+    if (process_switch_benchmark(rounds, 0, &plain) < 0 ||
+        process_switch_benchmark(rounds, 1, &fpu) < 0) {
+        terminal_writeln("ctxbench: cannot create threads");
+        return;
+    }
+
+    terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+    terminal_printf("Thread switch cost (2 kernel threads, %u yields each):\n", rounds);
+    terminal_setcolor(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    terminal_printf("  Integer only: %u cycles/switch over %u switches, %u #NM\n",
+                    (uint32_t)plain.cycles, plain.switches, (uint32_t)plain.fpu_traps);
+    terminal_printf("  Using SSE:    %u cycles/switch over %u switches, %u #NM\n",
+                    (uint32_t)fpu.cycles, fpu.switches, (uint32_t)fpu.fpu_traps);
+}
+
+// Free memory in 2MB units held by blocks of order 9 and up
+static uint32_t free_2mb_blocks(void) {
+    uint32_t blocks = 0;
+    for (uint32_t order = 9; order <= PMM_MAX_ORDER; order++) {
+        blocks += pmm_get_free_blocks(order) << (order - 9);
+    }
+    return blocks;
+}
+
+static void cmd_compact(int argc, char** argv) {
+    uint32_t blocks = 0;
+    if (argc > 1) {
+        int value = to_int(argv[1]);
+        if (value < 1) {
+            terminal_writeln("usage: compact [blocks]");
+            return;
+        }
+        blocks = (uint32_t)value;
+    }
+
+    uint32_t before = free_2mb_blocks();
+    paging_compact_stats_t start, end;
+    paging_get_compact_stats(&start);
+    uint32_t freed = paging_compact(blocks);
+    paging_get_compact_stats(&end);
+
+    terminal_printf("Compacted: %u movable pages, %u migrated, %u 2MB blocks freed\n",
+                    end.movable_pages, (uint32_t)(end.pages_migrated - start.pages_migrated),
+                    freed);
+    terminal_printf("  Free 2MB blocks: %u -> %u\n", before, free_2mb_blocks());
+}
+
+static void cmd_reclaim(int argc, char** argv) {
+    uint32_t pages = 256;
+    if (argc > 1) {
+        int value = to_int(argv[1]);
+        if (value < 1) {
+            terminal_writeln("usage: reclaim [pages]");
+            return;
+        }
+        pages = (uint32_t)value;
+    }
+
+    uint64_t before = get_free_memory();
+    uint32_t freed = paging_reclaim(pages);
+    terminal_printf("Reclaimed %u pages, free memory %u KB -> %u KB\n", freed,
+                    (uint32_t)(before / 1024), (uint32_t)(get_free_memory() / 1024));
+}
+
+static void cmd_uptime(int argc, char** argv) {
+    (void)argc; (void)argv;
+
+    timer_stats_t timer;
+    timer_get_stats(&timer);
+    if (!timer.hz) {
+        terminal_writeln("uptime: timer not running");
+        return;
+    }
+
+    uint64_t ms = timer_uptime_ms();
+    uint64_t ticks = jiffies;
+    uint32_t taken_pct = ticks ? (uint32_t)(timer.interrupts * 100 / ticks) : 0;
+    terminal_printf("Up %u.%03u s (%u ticks at %u Hz)\n", (uint32_t)(ms / 1000),
+                    (uint32_t)(ms % 1000), (uint32_t)ticks, timer.hz);
+    terminal_printf("  Timer IRQs:  %u (%u%% of ticks)\n", (uint32_t)timer.interrupts, taken_pct);
+    terminal_printf("  Idle sleeps: %u, %u ticks skipped, %u woken early\n",
+                    (uint32_t)timer.idle_sleeps, (uint32_t)timer.idle_ticks,
+                    (uint32_t)timer.early_wakeups);
+}
+
+static void cmd_heapstat(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        heap_profile_dump();
+        terminal_writeln("Heap profile written to serial");
+        return;
+    }
+
+    heap_profile_t profile;
+    heap_get_profile(&profile);
+
+    terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+    terminal_writeln("Heap Profile:");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    terminal_printf("  Used: %u KB (peak %u KB)\n",
+                    (uint32_t)(profile.used_size / 1024),
+                    (uint32_t)(profile.peak_used / 1024));
+    terminal_printf("  Free: %u KB, largest block %u KB, fragmentation %u.%u%%\n",
+                    (uint32_t)(profile.free_size / 1024),
+                    (uint32_t)(profile.largest_free / 1024),
+                    profile.frag_permille / 10, profile.frag_permille % 10);
+
+    // Top call sites by live bytes
+    terminal_writeln("  Site                    Live KB   Live   Total");
+    uint8_t shown[HEAP_MAX_SITES] = {0};
+    for (int row = 0; row < 10; row++) {
+        int best = -1;
+        for (uint32_t i = 0; i < HEAP_MAX_SITES; i++) {
+            const heap_site_t* site = heap_get_site(i);
+            if (!site || !site->live_allocs || shown[i]) continue;
+            if (best < 0 || site->live_bytes > heap_get_site(best)->live_bytes) {
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        shown[best] = 1;
+
+        const heap_site_t* site = heap_get_site(best);
+        if (site->tag) {
+            terminal_printf("  %-22s", site->tag);
+        } else {
+            terminal_printf("  caller 0x%08x       ", (uint32_t)site->caller);
+        }
+        terminal_printf(" %8u %6u %7u\n", (uint32_t)(site->live_bytes / 1024),
+                        site->live_allocs, site->total_allocs);
+    }
+
+    // Request size histogram (allocations since boot)
+    terminal_writeln("  Size histogram:");
+    for (uint32_t i = 0; i < HEAP_HIST_BUCKETS; i++) {
+        if (!profile.histogram[i]) continue;
+        if (i == HEAP_HIST_BUCKETS - 1) {
+            terminal_printf("    >%6u B: %u\n", 8u << i, profile.histogram[i]);
+        } else {
+            terminal_printf("    <=%6u B: %u\n", 16u << i, profile.histogram[i]);
+        }
+    }
 }
 
 static void cmd_echo(int argc, char** argv) {
@@ -83,8 +83,9 @@ void system_first_boot(exfat_volume_t* volume) {
     terminal_setcolor(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     terminal_writeln("Initializing filesystem...");
     
-    // Format exFAT
+    // Format exFAT; a pool from an earlier mount is sized for the old layout
     uint32_t sectors = (10 * 1024 * 1024) / 512;
+    exfat_unmount(volume);
     exfat_format(sectors);
     exfat_mount(volume);
     
@@ -228,6 +229,8 @@ void system_shutdown(void) {
         log_write(LOG_INFO, "SHUTDOWN", "Clean shutdown complete");
         logger_close();
     }
+
+    exfat_unmount(sys_volume);
     
     terminal_setcolor(VGA_COLOR_GREEN, VGA_COLOR_BLACK);
     terminal_writeln("System halted. Safe to power off.");